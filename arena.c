@@ -0,0 +1,102 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Bump allocator for the search results. Memory is carved from large
+ * chunks and only released all at once by arena_free().
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "provides.h"
+
+#define ARENA_CHUNK (64 * 1024)
+#define ARENA_ALIGN (sizeof(void *))
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    max_align_t data[];
+};
+
+void *
+arena_alloc(struct arena *a, size_t size)
+{
+    struct arena_chunk *chunk;
+    size_t csize;
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (size > a->left) {
+        csize = size > ARENA_CHUNK / 4 ? size : ARENA_CHUNK;
+        chunk = malloc(sizeof(struct arena_chunk) + csize);
+        if (chunk == NULL) {
+            exit(ENOMEM);
+        }
+        chunk->next = a->chunks;
+        a->chunks = chunk;
+        if (csize == size) {
+            /* big allocation, keep the current chunk in use */
+            return (chunk->data);
+        }
+        a->cur = (char *)chunk->data;
+        a->left = csize;
+    }
+
+    p = a->cur;
+    a->cur += size;
+    a->left -= size;
+
+    return (p);
+}
+
+char *
+arena_strndup(struct arena *a, const char *s, size_t len)
+{
+    char *p;
+
+    p = arena_alloc(a, len + 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+
+    return (p);
+}
+
+void
+arena_free(struct arena *a)
+{
+    struct arena_chunk *chunk;
+
+    while ((chunk = a->chunks) != NULL) {
+        a->chunks = chunk->next;
+        free(chunk);
+    }
+    a->cur = NULL;
+    a->left = 0;
+}
@@ -0,0 +1,336 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Batch mode: answer a list of patterns with a single pass over the
+ * database.
+ *
+ * The longest literal of every pattern is loaded in an Aho-Corasick
+ * automaton which runs once over each entry, only the patterns whose
+ * literal occurs in it are then matched by their regex. Patterns
+ * without any literal are matched against every entry.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include "bigram.h"
+#include "provides.h"
+
+/* Aho-Corasick automaton over the lower case literals */
+struct ac_state {
+    int32_t next[UCHAR_MAX + 1];    /* complete transition function */
+    int32_t fail;
+    int32_t out;                    /* first pattern ending here, -1 */
+    int32_t dict;                   /* next state along fail with out */
+};
+
+struct batch {
+    int npatterns;
+    struct search_t *searches;
+    int32_t *next_out;              /* next pattern with the same key */
+    int *always;                    /* patterns without literal */
+    int nalways;
+    struct ac_state *states;
+    int nstates;
+    int cap;
+    unsigned *seen;                 /* generation a pattern was queued */
+    unsigned gen;
+    int *cand;
+    int ncand;
+};
+
+static int
+ac_new_state(struct batch *b)
+{
+    struct ac_state *ns;
+
+    if (b->nstates == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 256;
+        ns = realloc(b->states, b->cap * sizeof(struct ac_state));
+        if (ns == NULL) {
+            exit(ENOMEM);
+        }
+        b->states = ns;
+    }
+    memset(b->states[b->nstates].next, 0xff, sizeof(b->states[0].next));
+    b->states[b->nstates].fail = 0;
+    b->states[b->nstates].out = -1;
+    b->states[b->nstates].dict = -1;
+
+    return (b->nstates++);
+}
+
+static void
+ac_add(struct batch *b, const char *key, size_t len, int pattern)
+{
+    int s = 0, c;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        c = (u_char)key[i];
+        if (b->states[s].next[c] < 0) {
+            int n = ac_new_state(b);
+            b->states[s].next[c] = n;
+        }
+        s = b->states[s].next[c];
+    }
+    b->next_out[pattern] = b->states[s].out;
+    b->states[s].out = pattern;
+}
+
+/*
+ * Compute the failure links breadth first and turn the trie into a
+ * complete automaton. Upper case bytes go where their lower case
+ * counterpart does, the entries don't need to be folded.
+ */
+static void
+ac_build(struct batch *b)
+{
+    int32_t *queue;
+    int head = 0, tail = 0, s, t, f, c;
+
+    if ((queue = malloc(b->nstates * sizeof(int32_t))) == NULL) {
+        exit(ENOMEM);
+    }
+
+    for (c = 0; c <= UCHAR_MAX; c++) {
+        t = b->states[0].next[c];
+        if (t > 0) {
+            b->states[t].fail = 0;
+            queue[tail++] = t;
+        } else {
+            b->states[0].next[c] = 0;
+        }
+    }
+
+    while (head < tail) {
+        s = queue[head++];
+        f = b->states[s].fail;
+        b->states[s].dict = b->states[f].out >= 0 ? f : b->states[f].dict;
+        for (c = 0; c <= UCHAR_MAX; c++) {
+            t = b->states[s].next[c];
+            if (t >= 0) {
+                b->states[t].fail = b->states[f].next[c];
+                queue[tail++] = t;
+            } else {
+                b->states[s].next[c] = b->states[f].next[c];
+            }
+        }
+    }
+
+    for (s = 0; s < b->nstates; s++) {
+        for (c = 'A'; c <= 'Z'; c++) {
+            b->states[s].next[c] = b->states[s].next[LOWER(c)];
+        }
+    }
+
+    free(queue);
+}
+
+static void
+queue_pattern(struct batch *b, int p)
+{
+    if (b->seen[p] != b->gen) {
+        b->seen[p] = b->gen;
+        b->cand[b->ncand++] = p;
+    }
+}
+
+static int
+int_cmp(const void *a, const void *b)
+{
+    return (*(const int *)a - *(const int *)b);
+}
+
+static void
+batch_cb(const char *line, void *extra)
+{
+    struct batch *b = extra;
+    const char *separator, *s;
+    int state, o, i;
+
+    if ((separator = strchr(line, '*')) == NULL) {
+        return;
+    }
+
+    b->gen++;
+    b->ncand = 0;
+    state = 0;
+    for (s = separator + 1; *s != '\0'; s++) {
+        state = b->states[state].next[(u_char)*s];
+        for (o = state; o >= 0; o = b->states[o].dict) {
+            for (i = b->states[o].out; i >= 0; i = b->next_out[i]) {
+                queue_pattern(b, i);
+            }
+        }
+    }
+    for (i = 0; i < b->nalways; i++) {
+        queue_pattern(b, b->always[i]);
+    }
+    if (b->ncand == 0) {
+        return;
+    }
+
+    /* results of an entry are reported in the order of the patterns */
+    qsort(b->cand, b->ncand, sizeof(int), int_cmp);
+    for (i = 0; i < b->ncand; i++) {
+        o = b->cand[i];
+        if (search_match(&b->searches[o], line) != NULL) {
+            printf("%s\t%.*s\t%s\n", b->searches[o].pattern,
+                (int)(separator - line), line, separator + 1);
+        }
+    }
+}
+
+static void
+batch_free(struct batch *b)
+{
+    int i;
+
+    for (i = 0; i < b->npatterns; i++) {
+        free(b->searches[i].pattern);
+        search_free(&b->searches[i]);
+    }
+    free(b->searches);
+    free(b->next_out);
+    free(b->always);
+    free(b->states);
+    free(b->seen);
+    free(b->cand);
+}
+
+/*
+ * Read the patterns of file, one per line, "-" being the standard input.
+ */
+static int
+batch_load(struct batch *b, const char *file)
+{
+    struct search_t *ns;
+    FILE *fp;
+    char *line = NULL, *pattern;
+    size_t linecap = 0, cap = 0;
+    ssize_t len;
+    int ret = 0;
+
+    if (strcmp(file, "-") == 0) {
+        fp = stdin;
+    } else if ((fp = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Can't open %s: %s\n", file, strerror(errno));
+        return (-1);
+    }
+
+    while ((len = getline(&line, &linecap, fp)) > 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        }
+        if ((size_t)b->npatterns == cap) {
+            cap = cap ? cap * 2 : 64;
+            ns = realloc(b->searches, cap * sizeof(struct search_t));
+            if (ns == NULL) {
+                exit(ENOMEM);
+            }
+            b->searches = ns;
+        }
+        if ((pattern = strdup(line)) == NULL) {
+            exit(ENOMEM);
+        }
+        if (search_init(&b->searches[b->npatterns], pattern) != 0) {
+            fprintf(stderr, "Pattern: %s\n", pattern);
+            free(pattern);
+            ret = -1;
+            break;
+        }
+        b->npatterns++;
+    }
+
+    free(line);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    return (ret);
+}
+
+/*
+ * Match the patterns listed in file against the database open on fd
+ * and print a "pattern<TAB>package<TAB>path" line for each match.
+ */
+int
+batch_run(int fd, const char *file)
+{
+    struct batch b;
+    struct pattern *lit;
+    struct db4 db4;
+    int i, ret;
+
+    memset(&b, 0, sizeof(b));
+
+    if (batch_load(&b, file) != 0) {
+        batch_free(&b);
+        return (-1);
+    }
+
+    b.next_out = malloc((b.npatterns + 1) * sizeof(int32_t));
+    b.always = malloc((b.npatterns + 1) * sizeof(int));
+    b.seen = calloc(b.npatterns + 1, sizeof(unsigned));
+    b.cand = malloc((b.npatterns + 1) * sizeof(int));
+    if (b.next_out == NULL || b.always == NULL || b.seen == NULL ||
+        b.cand == NULL) {
+        exit(ENOMEM);
+    }
+
+    ac_new_state(&b);
+    for (i = 0; i < b.npatterns; i++) {
+        lit = &b.searches[i].literals;
+        if (lit->nliterals > 0) {
+            ac_add(&b, lit->literals[0], lit->lens[0], i);
+        } else {
+            b.always[b.nalways++] = i;
+        }
+    }
+    ac_build(&b);
+
+    if ((ret = db4_open(&db4, fd)) == 0) {
+        ret = db4_expand(&db4, &batch_cb, &b);
+        db4_close(&db4);
+    } else if (ret > 0) {
+        ret = bigram_expand_fd(fd, &batch_cb, &b);
+    }
+
+    batch_free(&b);
+
+    return (ret);
+}
@@ -0,0 +1,255 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Synthetic provides database generator.
+ *
+ *	dbgen [-s seed] nentries file
+ *
+ * writes a locate database of about nentries "pkgname*path" entries,
+ * sorted like the output of provides-db-gen.rb piped through sort(1).
+ * Package sizes follow a Pareto distribution, a few packages holding
+ * most of the files like on a real repository, and paths are drawn from
+ * the usual /usr/local hierarchy. The same seed gives the same database.
+ *
+ * The entries are generated twice, package by package, so memory use
+ * doesn't depend on the size of the database: the first pass collects
+ * the bigram statistics, the second one encodes with the 128 most
+ * frequent bigrams, with the encoder of bigram.c.
+ */
+
+#include <err.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include "bigram.h"
+
+#define NWORDS      5000
+#define NELEM(a)    (sizeof(a) / sizeof((a)[0]))
+
+static const char *dirs[] = {
+    "bin", "sbin", "lib", "libexec", "include", "share/man/man1",
+    "share/man/man3", "share/locale/%s/LC_MESSAGES", "share/doc/%s",
+    "share/examples/%s", "lib/python3.11/site-packages/%s",
+    "share/icons/hicolor/%s/apps", "lib/perl5/site_perl/%s", "share/%s",
+    "include/%s", "lib/%s",
+};
+
+static const char *langs[] = {
+    "de", "fr", "es", "it", "ja", "ru", "pt_BR", "zh_CN", "pl", "nl",
+    "sv", "cs",
+};
+
+static const char *exts[] = {
+    "", ".so", ".so.1", ".a", ".h", ".py", ".pyc", ".mo", ".png", ".1.gz",
+    ".3.gz", ".pm", ".html", ".svg", ".xml", ".js",
+};
+
+struct package {
+    char *name;
+    unsigned long seed;
+    int nfiles;
+};
+
+static char *words[NWORDS];
+
+static unsigned long
+rnd(unsigned long *seed)
+{
+    *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+    return (*seed >> 33);
+}
+
+static char *
+word(unsigned long *seed)
+{
+    char buf[16];
+    int i, len;
+
+    len = 3 + rnd(seed) % 7;
+    for (i = 0; i < len; i++)
+        buf[i] = 'a' + rnd(seed) % 26;
+    buf[len] = '\0';
+
+    return (strdup(buf));
+}
+
+static int
+strptrcmp(const void *a, const void *b)
+{
+    return (strcmp(*(char * const *)a, *(char * const *)b));
+}
+
+static int
+package_cmp(const void *a, const void *b)
+{
+    return (strcmp(((const struct package *)a)->name,
+        ((const struct package *)b)->name));
+}
+
+/* Generate the entries of package p, sorted, into lines */
+static int
+package_lines(const struct package *p, char **lines)
+{
+    unsigned long seed = p->seed;
+    const char *base, *dir;
+    char d[MAXPATHLEN], sub[MAXPATHLEN], buf[MAXPATHLEN];
+    size_t len;
+    int i, j, n, nsub;
+
+    base = words[rnd(&seed) % NWORDS];
+    for (i = 0; i < p->nfiles; i++) {
+        dir = dirs[rnd(&seed) % NELEM(dirs)];
+        if (strstr(dir, "%s") != NULL) {
+            snprintf(d, sizeof(d), dir, strstr(dir, "locale") ?
+                langs[rnd(&seed) % NELEM(langs)] : base);
+            dir = d;
+        }
+        sub[0] = '\0';
+        nsub = rnd(&seed) % 3;
+        for (j = 0, len = 0; j < nsub; j++)
+            len += snprintf(sub + len, sizeof(sub) - len, "%s/",
+                words[rnd(&seed) % NWORDS]);
+        snprintf(buf, sizeof(buf), "%s*/usr/local/%s/%s%s%s", p->name, dir,
+            sub, words[rnd(&seed) % NWORDS], exts[rnd(&seed) % NELEM(exts)]);
+        if ((lines[i] = strdup(buf)) == NULL)
+            err(1, "strdup");
+    }
+    qsort(lines, p->nfiles, sizeof(char *), strptrcmp);
+
+    /* drop the duplicates */
+    for (i = 0, n = 0; i < p->nfiles; i++) {
+        if (n > 0 && strcmp(lines[i], lines[n - 1]) == 0) {
+            free(lines[i]);
+            continue;
+        }
+        lines[n++] = lines[i];
+    }
+
+    return (n);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: dbgen [-s seed] nentries file\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bigram_encoder *e;
+    struct package *pkgs = NULL;
+    FILE *fp;
+    unsigned long seed = 1, total = 0, nentries;
+    char **lines;
+    char name[64];
+    size_t npkgs = 0, cap = 0, i;
+    int ch, j, n, pass, maxfiles = 0;
+
+    while ((ch = getopt(argc, argv, "s:")) != -1) {
+        switch (ch) {
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 2 || (nentries = strtoul(argv[0], NULL, 10)) == 0)
+        usage();
+
+    for (i = 0; i < NWORDS; i++) {
+        if ((words[i] = word(&seed)) == NULL)
+            err(1, "strdup");
+    }
+
+    /* package sizes: Pareto distribution of shape 1.1, scale 20 */
+    while (total < nentries) {
+        if (npkgs == cap) {
+            cap = cap ? cap * 2 : 1024;
+            if ((pkgs = realloc(pkgs, cap * sizeof(*pkgs))) == NULL)
+                err(1, "realloc");
+        }
+        if (rnd(&seed) % 2)
+            snprintf(name, sizeof(name), "%s-%s%zu",
+                words[rnd(&seed) % NWORDS], words[rnd(&seed) % NWORDS],
+                npkgs);
+        else
+            snprintf(name, sizeof(name), "%s%zu",
+                words[rnd(&seed) % NWORDS], npkgs);
+        if ((pkgs[npkgs].name = strdup(name)) == NULL)
+            err(1, "strdup");
+        pkgs[npkgs].seed = rnd(&seed);
+        pkgs[npkgs].nfiles = 20 / pow((rnd(&seed) + 1) / 2147483649.0,
+            1 / 1.1);
+        if (pkgs[npkgs].nfiles > 200000)
+            pkgs[npkgs].nfiles = 200000;
+        if (pkgs[npkgs].nfiles > (long)(nentries - total))
+            pkgs[npkgs].nfiles = nentries - total;
+        if (pkgs[npkgs].nfiles > maxfiles)
+            maxfiles = pkgs[npkgs].nfiles;
+        total += pkgs[npkgs].nfiles;
+        npkgs++;
+    }
+    qsort(pkgs, npkgs, sizeof(*pkgs), package_cmp);
+
+    if ((lines = malloc(maxfiles * sizeof(char *))) == NULL ||
+        (e = calloc(1, sizeof(*e))) == NULL)
+        err(1, "malloc");
+    if ((fp = fopen(argv[1], "w")) == NULL)
+        err(1, "%s", argv[1]);
+    bigram_encode_init(e, fp);
+
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1)
+            bigram_encode_table(e);
+        for (i = 0; i < npkgs; i++) {
+            n = package_lines(&pkgs[i], lines);
+            for (j = 0; j < n; j++) {
+                if (pass == 0)
+                    bigram_encode_count(e, lines[j]);
+                else
+                    bigram_encode_line(e, lines[j]);
+                free(lines[j]);
+            }
+        }
+    }
+
+    if (fclose(fp) != 0)
+        err(1, "%s", argv[1]);
+
+    return (0);
+}
@@ -0,0 +1,220 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Cost of the search hot paths on a database built by dbgen:
+ *
+ *	hotpath [-n runs] file
+ *
+ * decoding alone, through stdio like a pipe and from memory like a
+ * regular file, decoding and matching with match_cb() for the usual
+ * classes of patterns, and grouping the results by package. Each
+ * figure is the best of the runs.
+ */
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bigram.h"
+#include "provides.h"
+
+#define NELEM(a)    (sizeof(a) / sizeof((a)[0]))
+
+static const char *classes[][2] = {
+    { "literal",        "\\.png" },
+    { "literal/path",   "share/locale/de/" },
+    { "anchored start", "^ab" },
+    { "anchored end",   "\\.so\\.1$" },
+    { "anchored both",  "^[a-z]+\\.pyc$" },
+    { "wide",           "[aeiou]" },
+};
+
+struct lines {
+    char **v;
+    size_t n;
+    size_t cap;
+    struct arena arena;
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+count_cb(const char *line, void *extra)
+{
+    (void)line;
+    (*(size_t *)extra)++;
+}
+
+static void
+collect_cb(const char *line, void *extra)
+{
+    struct lines *l = extra;
+
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 1024 * 1024;
+        if ((l->v = realloc(l->v, l->cap * sizeof(char *))) == NULL)
+            err(1, "realloc");
+    }
+    l->v[l->n++] = arena_strndup(&l->arena, line, strlen(line));
+}
+
+static size_t
+search_count(struct search_t *search)
+{
+    fpkg_t *pnode;
+    file_t *pfile;
+    size_t n = 0;
+
+    SLIST_FOREACH(pnode, &search->head, next) {
+        SLIST_FOREACH(pfile, &pnode->files, next)
+            n++;
+    }
+    return (n);
+}
+
+static void
+report(const char *name, const char *pattern, double t, size_t entries,
+    size_t matches)
+{
+    printf("%-16s %-20s %9.1f %9.1f %9zu\n", name, pattern, t * 1000,
+        entries / t / 1e6, matches);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct search_t search;
+    struct lines lines;
+    struct stat sb;
+    u_char *db;
+    FILE *fp;
+    double t, best;
+    size_t n, entries = 0, matches = 0, i;
+    int ch, c, r, fd, runs = 3;
+
+    while ((ch = getopt(argc, argv, "n:")) != -1) {
+        switch (ch) {
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: hotpath [-n runs] file\n");
+            return (1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 1 || runs < 1) {
+        fprintf(stderr, "usage: hotpath [-n runs] file\n");
+        return (1);
+    }
+
+    if ((fd = open(argv[0], O_RDONLY)) < 0 || fstat(fd, &sb) != 0)
+        err(1, "%s", argv[0]);
+    db = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (db == MAP_FAILED || (fp = fdopen(fd, "r")) == NULL)
+        err(1, "%s", argv[0]);
+
+    printf("%-16s %-20s %9s %9s %9s\n", "benchmark", "pattern", "ms",
+        "Mentry/s", "matches");
+
+    for (best = 0, r = 0; r < runs; r++) {
+        rewind(fp);
+        n = 0;
+        t = now();
+        if (bigram_expand(fp, count_cb, &n) != 0)
+            errx(1, "%s: corrupted database", argv[0]);
+        t = now() - t;
+        best = (r == 0 || t < best) ? t : best;
+    }
+    entries = n;
+    report("expand stdio", "", best, entries, 0);
+
+    for (best = 0, r = 0; r < runs; r++) {
+        n = 0;
+        t = now();
+        bigram_expand_mem(db, sb.st_size, count_cb, &n);
+        t = now() - t;
+        best = (r == 0 || t < best) ? t : best;
+    }
+    report("expand mmap", "", best, entries, 0);
+
+    for (c = 0; c < (int)NELEM(classes); c++) {
+        for (best = 0, r = 0; r < runs; r++) {
+            if (search_init(&search, (char *)classes[c][1]) != 0)
+                return (1);
+            t = now();
+            bigram_expand_mem(db, sb.st_size, match_cb, &search);
+            t = now() - t;
+            best = (r == 0 || t < best) ? t : best;
+            matches = search_count(&search);
+            search_free(&search);
+        }
+        report(classes[c][0], classes[c][1], best, entries, matches);
+    }
+
+    /* grouping alone: every entry added to the results */
+    memset(&lines, 0, sizeof(lines));
+    bigram_expand_mem(db, sb.st_size, collect_cb, &lines);
+    for (best = 0, r = 0; r < runs; r++) {
+        memset(&search, 0, sizeof(search));
+        SLIST_INIT(&search.head);
+        t = now();
+        for (i = 0; i < lines.n; i++)
+            search_add(&search, lines.v[i]);
+        t = now() - t;
+        best = (r == 0 || t < best) ? t : best;
+        matches = search_count(&search);
+        search_free(&search);
+    }
+    report("group", "", best, entries, matches);
+
+    free(lines.v);
+    arena_free(&lines.arena);
+    munmap(db, sb.st_size);
+    fclose(fp);
+
+    return (0);
+}
@@ -0,0 +1,180 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Cost of the regex step of a search with and without the literal
+ * prefilter, for the usual classes of patterns. The subjects are
+ * synthetic file paths and basenames.
+ */
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pcre2.h>
+#include <sys/types.h>
+
+#include "provides.h"
+
+#define NSUBJECTS   1000000
+
+static const char *classes[][2] = {
+    { "literal",        "libbz2.so." },
+    { "literal/path",   "share/locale/de" },
+    { "anchored start", "^libbz2" },
+    { "anchored end",   "bin/firefox$" },
+    { "anchored both",  "^python3.11$" },
+    { "wide",           "\\.so$" },
+    { "class",          "lib[a-z]+\\.so\\.[0-9]" },
+    { "no literal",     "^[a-z]{2}\\d$" },
+};
+
+static const char *dirs[] = {
+    "bin", "sbin", "lib", "libexec", "include", "share/man/man1",
+    "share/locale/de/LC_MESSAGES", "share/locale/fr/LC_MESSAGES",
+    "share/doc", "share/examples", "lib/python3.11/site-packages",
+    "share/icons/hicolor/48x48/apps", "lib/perl5/site_perl",
+};
+
+static const char *stems[] = {
+    "libbz2", "firefox", "python3.11", "gtk", "libGL", "qt6", "xz",
+    "curl", "openssl", "libstdc++", "glib", "cairo", "pango", "llvm",
+    "rust", "perl", "ruby", "zstd", "icu", "harfbuzz", "freetype",
+};
+
+static const char *suffixes[] = {
+    "", ".so", ".so.1", ".so.3", ".a", ".h", ".py", ".pyc", ".mo",
+    ".png", ".1.gz", ".pm", "-config", ".pc",
+};
+
+#define NELEM(a)    (sizeof(a) / sizeof((a)[0]))
+
+static unsigned long seed = 1;
+
+static unsigned long
+rnd(void)
+{
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    return (seed >> 33);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static double
+run(pcre2_code *re, pcre2_match_data *md, const struct pattern *pat,
+    char **subjects, size_t *lens, long *matches)
+{
+    double start;
+    size_t i;
+
+    *matches = 0;
+    start = now();
+    for (i = 0; i < NSUBJECTS; i++) {
+        if (pat != NULL && pat->nliterals > 0 &&
+            !pattern_prefilter(pat, subjects[i], lens[i]))
+            continue;
+        if (pcre2_match(re, (PCRE2_SPTR)subjects[i], lens[i], 0, 0, md,
+            NULL) > 0)
+            (*matches)++;
+    }
+
+    return (now() - start);
+}
+
+int
+main(void)
+{
+    char **paths, **bases, **subjects, buf[1024];
+    size_t *plens, *blens, *lens;
+    struct pattern pat;
+    pcre2_code *re;
+    pcre2_match_data *md;
+    PCRE2_SIZE erroff;
+    double tre, tpf;
+    long mre, mpf;
+    size_t i;
+    int err, c;
+
+    paths = malloc(NSUBJECTS * sizeof(char *));
+    bases = malloc(NSUBJECTS * sizeof(char *));
+    plens = malloc(NSUBJECTS * sizeof(size_t));
+    blens = malloc(NSUBJECTS * sizeof(size_t));
+    if (paths == NULL || bases == NULL || plens == NULL || blens == NULL)
+        return (1);
+
+    for (i = 0; i < NSUBJECTS; i++) {
+        snprintf(buf, sizeof(buf), "/usr/local/%s/%s%lu%s",
+            dirs[rnd() % NELEM(dirs)], stems[rnd() % NELEM(stems)],
+            rnd() % 100, suffixes[rnd() % NELEM(suffixes)]);
+        if ((paths[i] = strdup(buf)) == NULL)
+            return (1);
+        plens[i] = strlen(buf);
+        bases[i] = strrchr(paths[i], '/') + 1;
+        blens[i] = strlen(bases[i]);
+    }
+
+    printf("%-16s %-24s %9s %9s %8s %8s\n", "class", "pattern",
+        "regex ms", "filter ms", "speedup", "matches");
+
+    for (c = 0; c < (int)NELEM(classes); c++) {
+        const char *p = classes[c][1];
+
+        re = pcre2_compile((PCRE2_SPTR)p, PCRE2_ZERO_TERMINATED,
+            PCRE2_CASELESS, &err, &erroff, NULL);
+        if (re == NULL || pattern_analyse(&pat, p) != 0)
+            return (1);
+        md = pcre2_match_data_create_from_pattern(re, NULL);
+
+        /* same subject selection as match_cb() */
+        subjects = strchr(p, '/') ? paths : bases;
+        lens = strchr(p, '/') ? plens : blens;
+
+        tre = run(re, md, NULL, subjects, lens, &mre);
+        tpf = run(re, md, &pat, subjects, lens, &mpf);
+        if (mre != mpf) {
+            fprintf(stderr, "%s: prefilter lost matches\n", p);
+            return (1);
+        }
+
+        printf("%-16s %-24s %9.1f %9.1f %7.1fx %8ld\n", classes[c][0], p,
+            tre * 1000, tpf * 1000, tre / tpf, mre);
+
+        pattern_free(&pat);
+        pcre2_match_data_free(md);
+        pcre2_code_free(re);
+    }
+
+    return (0);
+}
@@ -41,20 +41,30 @@
 
 #include <ctype.h>
 #include <err.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "bigram.h"
 
 char separator='\n';   /* line separator */
 
+/*
+ * Returned by getwm() and getwf() for an integer out of +-MAXPATHLEN,
+ * it takes the decoder count out of range so the entry is rejected.
+ */
+#define BADWORD (-2 * MAXPATHLEN)
+
 /* 
  * Validate bigram chars. If the test failed the database is corrupt 
- * or the database is obviously not a locate database.
+ * or the database is obviously not a locate database, -1 is returned.
  */
 int
 check_bigram_char(int ch)
@@ -64,8 +74,7 @@ check_bigram_char(int ch)
         (ch >= ASCII_MIN && ch <= ASCII_MAX))
         return(ch);
 
-    fprintf(stderr, "Provides database corrupted, perform a forced update to correct it.\n");
-    exit (1);
+    return (-1);
 }
 
 /*
@@ -94,11 +103,8 @@ getwm(caddr_t p)
 
     if (i > MAXPATHLEN || i < -(MAXPATHLEN)) {
         hi = ntohl(i);
-        if (hi > MAXPATHLEN || hi < -(MAXPATHLEN)) {
-            fprintf(stderr, "integer out of +-MAXPATHLEN (%d): %u",
-                    MAXPATHLEN, abs(i) < abs(hi) ? i : hi);
-            exit (1);
-        }
+        if (hi > MAXPATHLEN || hi < -(MAXPATHLEN))
+            return (BADWORD);
         return(hi);
     }
     return(i);
@@ -122,19 +128,18 @@ getwf(FILE *fp)
     if (word > MAXPATHLEN || word < -(MAXPATHLEN)) {
         hword = ntohl(word);
         if (hword > MAXPATHLEN || hword < -(MAXPATHLEN))
-            errx(1, "integer out of +-MAXPATHLEN (%d): %u",
-                MAXPATHLEN, abs(word) < abs(hword) ? word : hword);
+            return (BADWORD);
         return(hword);
     }
     return(word);
 }
 
 int
-bigram_expand(FILE *fp, int (*match_cb)(char *,void *), void * extra)
+bigram_expand(FILE *fp, void (*match_cb)(const char *, void *), void *extra)
 {
     register u_char *p, *s;
     register int c;
-    int count, found, globflag;
+    int count, found, globflag, p1, s1;
     u_char *cutoff;
     u_char bigram1[NBG], bigram2[NBG], path[MAXPATHLEN];
 
@@ -143,8 +148,11 @@ bigram_expand(FILE *fp, int (*match_cb)(char *,void *), void * extra)
 
     /* init bigram table */
     for (c = 0, p = bigram1, s = bigram2; c < NBG; c++) {
-        p[c] = check_bigram_char(getc(fp));
-        s[c] = check_bigram_char(getc(fp));
+        if ((p1 = check_bigram_char(getc(fp))) < 0 ||
+            (s1 = check_bigram_char(getc(fp))) < 0)
+            return (-1);
+        p[c] = p1;
+        s[c] = s1;
     }
 
     /* main loop */
@@ -198,3 +206,294 @@ bigram_expand(FILE *fp, int (*match_cb)(char *,void *), void * extra)
 
     return (0);
 }
+
+/*
+ * Prepare the decoding of a database already mapped in memory.
+ * Returns -1 if the buffer does not start with a valid bigram table.
+ */
+int
+bigram_iter_init(struct bigram_iter *it, const u_char *db, size_t len)
+{
+    int c, p1, s1;
+
+    if (len < 2 * NBG)
+        return (-1);
+
+    for (c = 0; c < NBG; c++) {
+        if ((p1 = check_bigram_char(db[2 * c])) < 0 ||
+            (s1 = check_bigram_char(db[2 * c + 1])) < 0)
+            return (-1);
+        it->bigram1[c] = p1;
+        it->bigram2[c] = s1;
+    }
+
+    it->base = db;
+    it->p = db + 2 * NBG;
+    it->end = db + len;
+    it->size = len;
+    it->count = 0;
+    it->len = 0;
+    it->path[0] = '\0';
+
+    return (0);
+}
+
+/*
+ * Restart the decoding at byte offset off, the entries up to end are
+ * decoded. The path and count are the state of the decoder right
+ * before the entry at off, as recorded by a previous pass.
+ */
+int
+bigram_iter_seek(struct bigram_iter *it, size_t off, size_t end,
+    int count, const char *path, size_t len)
+{
+    if (off < 2 * NBG || off > end || end > it->size ||
+        count < 0 || count > (int)len || len > MAXPATHLEN)
+        return (-1);
+
+    it->p = it->base + off;
+    it->end = it->base + end;
+    it->count = count;
+    it->len = len;
+    memcpy(it->path, path, len);
+    it->path[len] = '\0';
+
+    return (0);
+}
+
+/*
+ * Decode the next entry into it->path.
+ * Same algorithm as bigram_expand() but driven by pointer arithmetic
+ * instead of one stdio call per byte. Returns 1 when an entry has
+ * been decoded, 0 at the end of the database and -1 if the data is
+ * corrupted.
+ */
+int
+bigram_iter_next(struct bigram_iter *it)
+{
+    register const u_char *s;
+    register u_char *p;
+    register int c;
+    u_char *limit;
+
+    s = it->p;
+    if (s >= it->end)
+        return (0);
+
+    /* go forward or backward */
+    c = *s++;
+    if (c == SWITCH) { /* big step, an integer */
+        if (it->end - s < (ptrdiff_t)INTSIZE)
+            return (-1);
+        it->count += getwm((caddr_t)s) - OFFSET;
+        s += INTSIZE;
+    } else {       /* slow step, =< 14 chars */
+        it->count += c - OFFSET;
+    }
+
+    if (it->count < 0 || it->count > MAXPATHLEN)
+        return (-1);
+    /* overlay old path */
+    p = it->path + it->count;
+    limit = it->path + MAXPATHLEN;
+
+    for (; s < it->end; s++) {
+        c = *s;
+        if (c < PARITY) {
+            if (c <= UMLAUT) {
+                if (c != UMLAUT)
+                    break; /* offset of the next entry */
+                if (++s == it->end)
+                    return (-1);
+                c = *s;
+            }
+            if (p >= limit)
+                return (-1);
+            *p++ = c;
+        } else {
+            /* bigrams are parity-marked */
+            TO7BIT(c);
+
+            if (p + 2 > limit)
+                return (-1);
+            *p++ = it->bigram1[c];
+            *p++ = it->bigram2[c];
+        }
+    }
+    *p = '\0';
+
+    it->len = p - it->path;
+    it->p = s;
+
+    return (1);
+}
+
+int
+bigram_expand_mem(const u_char *db, size_t len,
+    void (*match_cb)(const char *, void *), void *extra)
+{
+    struct bigram_iter it;
+    int ret;
+
+    if (bigram_iter_init(&it, db, len) != 0)
+        return (-1);
+
+    while ((ret = bigram_iter_next(&it)) > 0)
+        match_cb((char *)it.path, extra);
+
+    return (ret);
+}
+
+/*
+ * Expand the database behind fd. Regular files are mapped in memory
+ * and walked with bigram_iter_next(), anything else (pipes, special
+ * files) goes through the stdio based bigram_expand().
+ */
+int
+bigram_expand_fd(int fd, void (*match_cb)(const char *, void *), void *extra)
+{
+    struct stat sb;
+    FILE *fp;
+    void *db;
+    int ret;
+
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        db = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (db != MAP_FAILED) {
+            madvise(db, sb.st_size, MADV_SEQUENTIAL);
+            madvise(db, sb.st_size, MADV_WILLNEED);
+            ret = bigram_expand_mem(db, sb.st_size, match_cb, extra);
+            munmap(db, sb.st_size);
+            return (ret);
+        }
+    }
+
+    if ((fd = dup(fd)) < 0)
+        return (-1);
+    if ((fp = fdopen(fd, "r")) == NULL) {
+        close(fd);
+        return (-1);
+    }
+    ret = bigram_expand(fp, match_cb, extra);
+    fclose(fp);
+
+    return (ret);
+}
+
+/*
+ * Encoder, the inverse of bigram_expand(): locate.bigram and locate.code
+ * in a single program. The sorted entries are given twice, first to
+ * bigram_encode_count() to collect the bigram statistics, then to
+ * bigram_encode_line() once bigram_encode_table() has written the 128
+ * most frequent bigrams.
+ */
+static int
+prefix_len(const char *a, const char *b)
+{
+    int i;
+
+    for (i = 0; a[i] != '\0' && a[i] == b[i]; i++)
+        ;
+    return (i);
+}
+
+void
+bigram_encode_init(struct bigram_encoder *e, FILE *fp)
+{
+    memset(e, 0, sizeof(*e));
+    e->fp = fp;
+}
+
+void
+bigram_encode_count(struct bigram_encoder *e, const char *line)
+{
+    const u_char *s;
+
+    s = (const u_char *)line + prefix_len(line, e->prev);
+    for (; s[0] != '\0' && s[1] != '\0'; s += 2)
+        e->counts[s[0]][s[1]]++;
+    snprintf(e->prev, sizeof(e->prev), "%s", line);
+}
+
+/* Write the 128 most frequent bigrams, the header of the database */
+void
+bigram_encode_table(struct bigram_encoder *e)
+{
+    unsigned long best;
+    int i, a, b, ba, bb;
+
+    memset(e->code, -1, sizeof(e->code));
+    for (i = 0; i < NBG; i++) {
+        best = 0;
+        ba = bb = 0;
+        for (a = ASCII_MIN; a <= ASCII_MAX; a++) {
+            for (b = ASCII_MIN; b <= ASCII_MAX; b++) {
+                if (e->counts[a][b] > best && e->code[a][b] < 0) {
+                    best = e->counts[a][b];
+                    ba = a;
+                    bb = b;
+                }
+            }
+        }
+        if (best == 0) {
+            /* fewer bigrams than table entries, pad it */
+            putc(0, e->fp);
+            putc(0, e->fp);
+            continue;
+        }
+        e->code[ba][bb] = i;
+        putc(ba, e->fp);
+        putc(bb, e->fp);
+    }
+    e->prev[0] = '\0';
+    e->oldcount = 0;
+}
+
+static void
+encode_literal(struct bigram_encoder *e, int c)
+{
+    if (c < ASCII_MIN || c > ASCII_MAX)
+        putc(UMLAUT, e->fp);
+    putc(c, e->fp);
+}
+
+/*
+ * Write line front-coded against the previous one. Returns -1, writing
+ * nothing, if it can't be decoded back: too long or holding the line
+ * separator.
+ */
+int
+bigram_encode_line(struct bigram_encoder *e, const char *line)
+{
+    const u_char *s;
+    int count, diff;
+
+    if (strlen(line) >= MAXPATHLEN || strchr(line, separator) != NULL)
+        return (-1);
+
+    count = prefix_len(line, e->prev);
+    diff = count - e->oldcount;
+    e->oldcount = count;
+    if (diff < -OFFSET || diff > OFFSET) {
+        putc(SWITCH, e->fp);
+        putw(diff + OFFSET, e->fp);
+    } else {
+        putc(diff + OFFSET, e->fp);
+    }
+
+    for (s = (const u_char *)line + count; *s != '\0'; s += 2) {
+        if (s[1] == '\0') {
+            encode_literal(e, s[0]);
+            break;
+        }
+        if (e->code[s[0]][s[1]] >= 0) {
+            putc(PARITY | e->code[s[0]][s[1]], e->fp);
+        } else {
+            encode_literal(e, s[0]);
+            encode_literal(e, s[1]);
+        }
+    }
+    snprintf(e->prev, sizeof(e->prev), "%s", line);
+
+    return (0);
+}
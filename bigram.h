@@ -37,6 +37,8 @@
  * $FreeBSD$
  */
 
+#include <limits.h>
+
 /* Symbolic constants shared by locate.c and code.c */
 
 #define	NBG		128		/* number of bigrams considered */
@@ -65,8 +67,51 @@
    define TOLOWER(ch)	  tolower(ch)
 #else
 
-u_char myctype[UCHAR_MAX + 1];
+extern u_char myctype[UCHAR_MAX + 1];
 #define TOLOWER(ch)	(myctype[ch])
 #endif
 
 #define INTSIZE (sizeof(int))
+
+/*
+ * Decoder state used to walk a database mapped in memory, one entry
+ * at a time. The path buffer holds the current entry, the following
+ * entries are front-coded against it.
+ */
+struct bigram_iter {
+    const u_char *base;             /* beginning of the database */
+    const u_char *p;                /* next entry to decode */
+    const u_char *end;              /* end of the decoded range */
+    size_t size;                    /* size of the database */
+    int count;                      /* length of the shared prefix */
+    size_t len;                     /* length of the current path */
+    u_char bigram1[NBG];
+    u_char bigram2[NBG];
+    u_char path[MAXPATHLEN + 1];
+};
+
+/*
+ * Encoder state, the bigram statistics of the first pass over the
+ * entries, then the codes of the 128 most frequent bigrams and the
+ * previous entry while encoding.
+ */
+struct bigram_encoder {
+    FILE *fp;
+    unsigned long counts[UCHAR_MAX + 1][UCHAR_MAX + 1];
+    int code[UCHAR_MAX + 1][UCHAR_MAX + 1];
+    char prev[MAXPATHLEN + 1];
+    int oldcount;
+};
+
+int bigram_iter_init(struct bigram_iter *it, const u_char *db, size_t len);
+int bigram_iter_seek(struct bigram_iter *it, size_t off, size_t end,
+    int count, const char *path, size_t len);
+int bigram_iter_next(struct bigram_iter *it);
+int bigram_expand(FILE *fp, void (*match_cb)(const char *, void *), void *extra);
+int bigram_expand_mem(const u_char *db, size_t len,
+    void (*match_cb)(const char *, void *), void *extra);
+int bigram_expand_fd(int fd, void (*match_cb)(const char *, void *), void *extra);
+void bigram_encode_init(struct bigram_encoder *e, FILE *fp);
+void bigram_encode_count(struct bigram_encoder *e, const char *line);
+void bigram_encode_table(struct bigram_encoder *e);
+int bigram_encode_line(struct bigram_encoder *e, const char *line);
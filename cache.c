@@ -0,0 +1,225 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Cache of the search results, one file per search in the cache
+ * directory, named after the SHA256 of the search mode and pattern.
+ *
+ * A file starts with the identity of the database it was computed on
+ * and the search itself, followed by the results as "pkgname*path"
+ * lines. It is only used while provides.db keeps the same identity and
+ * the whole directory is cleared when an update installs a new
+ * database.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sha256.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "provides.h"
+
+#define CACHE_MAGIC     "PRVDCACHE 1"
+#define CACHE_MAX_FILES 512         /* the cache is cleared beyond */
+#define CACHE_MAX_LINES 65536       /* larger results are not cached */
+
+/* Path of the cache file of the search, -1 if it doesn't fit */
+static int
+cache_path(char *path, size_t size, const char *dir, int mode,
+    const char *pattern)
+{
+    SHA256_CTX ctx;
+    char digest[65];
+    char m = '0' + mode;
+
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, &m, 1);
+    SHA256_Update(&ctx, pattern, strlen(pattern));
+    SHA256_End(&ctx, digest);
+
+    return (snprintf(path, size, "%s/%s", dir, digest) >= (int)size ?
+        -1 : 0);
+}
+
+/* The first two lines of the cache file of the search */
+static int
+cache_header(char *hdr, size_t size, int dbfd, int mode, const char *pattern)
+{
+    struct stat sb;
+
+    if (fstat(dbfd, &sb) != 0 || strchr(pattern, '\n') != NULL)
+        return (-1);
+
+    return (snprintf(hdr, size, "%s %jd %jd %ld %ju\n%d %s\n", CACHE_MAGIC,
+        (intmax_t)sb.st_size, (intmax_t)sb.st_mtim.tv_sec,
+        (long)sb.st_mtim.tv_nsec, (uintmax_t)sb.st_ino, mode, pattern) >=
+        (int)size ? -1 : 0);
+}
+
+/*
+ * Load the results of the search from the cache in dir, for the
+ * database open on dbfd. Returns -1 if they are not there.
+ */
+int
+cache_get(const char *dir, int dbfd, int mode, const char *pattern,
+    struct search_t *search)
+{
+    char path[MAXPATHLEN];
+    char hdr[MAXPATHLEN * 2];
+    char *line = NULL;
+    size_t cap = 0, hlen, off;
+    ssize_t len;
+    FILE *fp;
+    int ret = -1;
+
+    memset(search, 0, sizeof(*search));
+    SLIST_INIT (&search->head);
+
+    if (cache_path(path, sizeof(path), dir, mode, pattern) != 0 ||
+        cache_header(hdr, sizeof(hdr), dbfd, mode, pattern) != 0)
+        return (-1);
+    if ((fp = fopen(path, "r")) == NULL)
+        return (-1);
+
+    /* the header is made of two lines */
+    hlen = strlen(hdr);
+    for (off = 0; off < hlen; off += len) {
+        if ((len = getline(&line, &cap, fp)) <= 0 ||
+            (size_t)len > hlen - off ||
+            memcmp(line, hdr + off, len) != 0)
+            break;
+    }
+
+    if (off == hlen) {
+        ret = 0;
+        while ((len = getline(&line, &cap, fp)) > 0) {
+            if (line[len - 1] != '\n') {
+                ret = -1;
+                break;
+            }
+            line[len - 1] = '\0';
+            if (search_add(search, line) != 0) {
+                ret = -1;
+                break;
+            }
+        }
+        if (ferror(fp))
+            ret = -1;
+    } else {
+        /* computed on another database */
+        unlink(path);
+    }
+    free(line);
+    fclose(fp);
+
+    if (ret != 0)
+        search_free(search);
+
+    return (ret);
+}
+
+/*
+ * Store the results of the search in the cache in dir. Failures are
+ * not reported, the search is just run again next time.
+ */
+void
+cache_put(const char *dir, int dbfd, int mode, const char *pattern,
+    struct search_t *search)
+{
+    char path[MAXPATHLEN];
+    char tmppath[MAXPATHLEN];
+    char hdr[MAXPATHLEN * 2];
+    struct dirent *de;
+    fpkg_t *pnode;
+    file_t *pfile;
+    size_t nlines = 0;
+    FILE *fp;
+    DIR *d;
+    int fd, nfiles = 0;
+
+    SLIST_FOREACH(pnode, &search->head, next) {
+        SLIST_FOREACH(pfile, &pnode->files, next) {
+            if (++nlines > CACHE_MAX_LINES)
+                return;
+        }
+    }
+
+    if (cache_path(path, sizeof(path), dir, mode, pattern) != 0 ||
+        cache_header(hdr, sizeof(hdr), dbfd, mode, pattern) != 0 ||
+        snprintf(tmppath, sizeof(tmppath), "%s/.tmp.XXXXXX", dir) >=
+        (int)sizeof(tmppath))
+        return;
+
+    if ((d = opendir(dir)) == NULL) {
+        if (errno != ENOENT || mkdir(dir, 0755) != 0)
+            return;
+    } else {
+        while ((de = readdir(d)) != NULL)
+            nfiles++;
+        closedir(d);
+        if (nfiles >= CACHE_MAX_FILES)
+            cache_clear(dir);
+    }
+
+    if ((fd = mkstemp(tmppath)) < 0)
+        return;
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if ((fp = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        unlink(tmppath);
+        return;
+    }
+    fputs(hdr, fp);
+    if (search_write(search, fp) != 0 || fclose(fp) != 0 ||
+        rename(tmppath, path) != 0)
+        unlink(tmppath);
+}
+
+/* Remove the cached results in dir */
+void
+cache_clear(const char *dir)
+{
+    struct dirent *de;
+    DIR *d;
+
+    if ((d = opendir(dir)) == NULL)
+        return;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.' && (de->d_name[1] == '\0' ||
+            (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+            continue;
+        unlinkat(dirfd(d), de->d_name, 0);
+    }
+    closedir(d);
+}
@@ -28,8 +28,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+
+#include "provides.h"
 
 #define PKG_DB_URL  "https://pkg-provides.osorio.me"
+#define PKG_DB_SOCKET "/var/db/pkg/provides/provides.sock"
 
 static char * url = NULL;
 static char * filepath = NULL;
@@ -45,6 +49,61 @@ config_fetch_on_update()
     return (1);
 }
 
+int
+config_cache()
+{
+    const char * str = getenv("PROVIDES_CACHE");
+    if (str != NULL && strcasecmp(str,"no") == 0) {
+        return (0);
+    }
+
+    return (1);
+}
+
+int
+config_stats()
+{
+    const char * str = getenv("PROVIDES_STATS");
+    if (str == NULL || *str == '\0' || strcasecmp(str,"no") == 0) {
+        return (0);
+    }
+    if (strcasecmp(str, "json") == 0) {
+        return (STATS_JSON);
+    }
+
+    return (STATS_TEXT);
+}
+
+int
+config_regex_engine()
+{
+    const char * str = getenv("PROVIDES_REGEX_ENGINE");
+    if (str == NULL) {
+        return (REGEX_ENGINE_AUTO);
+    }
+    if (strcasecmp(str, "jit") == 0) {
+        return (REGEX_ENGINE_JIT);
+    }
+    if (strcasecmp(str, "interp") == 0) {
+        return (REGEX_ENGINE_INTERP);
+    }
+    return (REGEX_ENGINE_AUTO);
+}
+
+int
+config_jobs()
+{
+    const char * str = getenv("PROVIDES_JOBS");
+    long jobs;
+
+    if (str != NULL && (jobs = strtol(str, NULL, 10)) > 0) {
+        return (jobs);
+    }
+
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    return (jobs > 0 ? jobs : 1);
+}
+
 char *
 config_get_remote_srv()
 {
@@ -78,3 +137,11 @@ config_get_filepath()
     }
     return filepath;
 }
+
+char *
+config_socket_path()
+{
+    const char * env = getenv("PROVIDES_SOCKET");
+
+    return ((char *)((env != NULL && *env != '\0') ? env : PKG_DB_SOCKET));
+}
@@ -0,0 +1,922 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Reader of the v4 provides database, see db4.h for its layout.
+ *
+ * A pattern without '/' only looks at the basenames, each of them is
+ * matched once in the basename table and the records are then scanned
+ * for their ids. Other patterns are matched against the path of every
+ * file, built from the directory and basename tables, which are then
+ * decoded once in memory. The packages are cut in tasks of about
+ * TASK_FILES files, decoded and matched on config_jobs() threads, and
+ * their results merged in database order.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "db4.h"
+#include "provides.h"
+
+#define TASK_BASENAMES  4096        /* basenames per task, in blocks */
+#define TASK_FILES      65536       /* files decoded per task, about */
+
+/* Sequential decoder of the basenames, from the start of a block */
+struct bn_cursor {
+    const u_char *p;                /* next entry, NULL before a seek */
+    uint32_t id;                    /* of the next entry */
+    size_t len;
+    char name[MAXPATHLEN];          /* of the last entry decoded */
+};
+
+struct db4_iter {
+    const struct db4 *db;
+    const u_char *p;
+    const u_char *end;
+    uint32_t left;                  /* files left in the package */
+    uint32_t dir;
+    uint32_t basename;
+    uint32_t pathdir;               /* directory whose path is in path */
+    uint32_t pathparent;
+    size_t dirlen;
+    size_t parentlen;
+    char path[MAXPATHLEN];
+    struct bn_cursor bn;
+};
+
+struct db4_result {
+    uint32_t *files;                /* package, directory and basename */
+    size_t len;
+    size_t cap;
+};
+
+struct db4_pool {
+    struct db4 *db;
+    struct search_t *search;
+    u_char *hits;                   /* matching basenames, or NULL */
+    uint32_t *tasks;                /* first package of each task */
+    uint32_t ntasks;
+    struct db4_result *results;
+    atomic_uint next;               /* next task to process */
+    atomic_int error;
+};
+
+static const u_char *
+get_varint(const u_char *p, const u_char *end, uint32_t *v)
+{
+    int shift;
+
+    *v = 0;
+    for (shift = 0; p < end && shift < 32; shift += 7) {
+        *v |= (uint32_t)(*p & 0x7f) << shift;
+        if ((*p++ & 0x80) == 0)
+            return (p);
+    }
+
+    return (NULL);
+}
+
+static const char *
+package_name(const struct db4 *db, uint32_t i)
+{
+    uint32_t off;
+
+    off = get_le32(db->packages + (size_t)i * DB4_PACKAGE_SIZE);
+    return (off < db->pkgnames_size ? db->pkgnames + off : NULL);
+}
+
+/* A section of n names must end with the terminator of its last name */
+static int
+check_names(const void *names, size_t size, uint32_t n)
+{
+    return (n == 0 || (size > 0 && ((const char *)names)[size - 1] == '\0') ?
+        0 : -1);
+}
+
+/*
+ * Map the database open on fd. Returns 1 if it is not a v4 database
+ * and -1 if it is corrupted.
+ */
+int
+db4_open(struct db4 *db, int fd)
+{
+    struct stat sb;
+    u_char magic[DB4_MAGIC_SIZE];
+    const u_char *t;
+    uint64_t off[5], dirblocks, bnblocks;
+    int i;
+
+    memset(db, 0, sizeof(*db));
+
+    if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+        memcmp(magic, DB4_MAGIC, DB4_MAGIC_SIZE) != 0)
+        return (1);
+    if (fstat(fd, &sb) != 0 ||
+        sb.st_size < DB4_MAGIC_SIZE + DB4_TRAILER_SIZE)
+        return (-1);
+    db->map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (db->map == MAP_FAILED) {
+        db->map = NULL;
+        return (-1);
+    }
+    db->size = sb.st_size;
+
+    t = db->map + db->size - DB4_TRAILER_SIZE;
+    for (i = 0; i < 4; i++)
+        off[i] = get_le64(t + DB4_T_DIRS + i * 8);
+    off[4] = db->size - DB4_TRAILER_SIZE;
+    db->ndirs = get_le32(t + DB4_T_NDIRS);
+    db->nbasenames = get_le32(t + DB4_T_NBASENAMES);
+    db->npackages = get_le32(t + DB4_T_NPACKAGES);
+    db->nfiles = get_le64(t + DB4_T_NFILES);
+    dirblocks = howmany((uint64_t)db->ndirs, DB4_BLOCK);
+    bnblocks = howmany((uint64_t)db->nbasenames, DB4_BLOCK);
+
+    if (memcmp(t + DB4_T_MAGIC, DB4_MAGIC, DB4_MAGIC_SIZE) != 0 ||
+        off[0] != DB4_MAGIC_SIZE || db->ndirs == 0 ||
+        off[1] < off[0] || off[2] < off[1] || off[3] < off[2] ||
+        off[4] < off[3] ||
+        off[1] - off[0] < dirblocks * 4 || off[2] - off[1] < bnblocks * 4 ||
+        off[4] - off[3] < (uint64_t)db->npackages * DB4_PACKAGE_SIZE)
+        goto corrupted;
+
+    db->dirs = db->map + off[0];
+    db->dirdata = db->dirs + dirblocks * 4;
+    db->dirdata_size = db->map + off[1] - db->dirdata;
+    db->basenames = db->map + off[1];
+    db->bndata = db->basenames + bnblocks * 4;
+    db->bndata_size = db->map + off[2] - db->bndata;
+    db->records = db->map + off[2];
+    db->records_size = off[3] - off[2];
+    db->packages = db->map + off[3];
+    db->pkgnames = (const char *)db->packages +
+        (size_t)db->npackages * DB4_PACKAGE_SIZE;
+    db->pkgnames_size = db->map + off[4] - (const u_char *)db->pkgnames;
+
+    if (check_names(db->dirdata, db->dirdata_size, db->ndirs) != 0 ||
+        check_names(db->bndata, db->bndata_size, db->nbasenames) != 0 ||
+        check_names(db->pkgnames, db->pkgnames_size, db->npackages) != 0)
+        goto corrupted;
+
+    return (0);
+
+corrupted:
+    db4_close(db);
+    return (-1);
+}
+
+void
+db4_close(struct db4 *db)
+{
+    free(db->dirtab);
+    free(db->bntab);
+    free(db->bnbuf);
+    if (db->map != NULL)
+        munmap(db->map, db->size);
+    memset(db, 0, sizeof(*db));
+}
+
+/* Decode the entry of directory id, its parent always comes before it */
+static int
+dir_entry(const struct db4 *db, uint32_t id, uint32_t *parent,
+    const char **name)
+{
+    const u_char *p, *end = db->dirdata + db->dirdata_size;
+    uint32_t off, delta, i;
+
+    if (id >= db->ndirs)
+        return (-1);
+    if (db->dirtab != NULL) {
+        *parent = db->dirtab[2 * id];
+        *name = (const char *)db->dirdata + db->dirtab[2 * id + 1];
+        return (0);
+    }
+    off = get_le32(db->dirs + (size_t)(id / DB4_BLOCK) * 4);
+    if (off >= db->dirdata_size)
+        return (-1);
+    for (i = id - id % DB4_BLOCK, p = db->dirdata + off;; i++) {
+        if ((p = get_varint(p, end, &delta)) == NULL || p >= end)
+            return (-1);
+        if (i == id)
+            break;
+        /* the section ends with a terminator */
+        p += strlen((const char *)p) + 1;
+    }
+    if (delta > id || (delta == 0 && id != 0))
+        return (-1);
+    *parent = id - delta;
+    *name = (const char *)p;
+
+    return (0);
+}
+
+/*
+ * Decode the whole directory table, for the searches building the path
+ * of every file. Returns -1 if it is corrupted.
+ */
+static int
+dirs_load(struct db4 *db)
+{
+    const u_char *p = db->dirdata, *end = db->dirdata + db->dirdata_size;
+    uint32_t *tab, delta, i;
+
+    if (db->dirtab != NULL)
+        return (0);
+    if ((tab = malloc((size_t)db->ndirs * 2 * sizeof(uint32_t))) == NULL)
+        exit(ENOMEM);
+    for (i = 0; i < db->ndirs; i++) {
+        if ((p = get_varint(p, end, &delta)) == NULL || p >= end ||
+            delta > i || (delta == 0 && i != 0)) {
+            free(tab);
+            return (-1);
+        }
+        tab[2 * i] = i - delta;
+        tab[2 * i + 1] = p - db->dirdata;
+        p += strlen((const char *)p) + 1;
+    }
+    db->dirtab = tab;
+
+    return (0);
+}
+
+/*
+ * Write the path of directory id to buf, "" for the root.
+ * Returns its length, -1 if the directory table is corrupted.
+ */
+static int
+dir_path(const struct db4 *db, uint32_t id, char *buf, size_t size)
+{
+    const char *chain[MAXPATHLEN / 2];
+    size_t len = 0, n;
+    int depth = 0;
+
+    while (id != 0) {
+        if (depth == MAXPATHLEN / 2 ||
+            dir_entry(db, id, &id, &chain[depth++]) != 0)
+            return (-1);
+    }
+    while (depth > 0) {
+        n = strlen(chain[--depth]);
+        if (len + n + 1 >= size)
+            return (-1);
+        buf[len++] = '/';
+        memcpy(buf + len, chain[depth], n);
+        len += n;
+    }
+    buf[len] = '\0';
+
+    return (len);
+}
+
+/* Position c on the first basename of the block of id */
+static int
+bn_seek(const struct db4 *db, struct bn_cursor *c, uint32_t id)
+{
+    uint32_t off;
+
+    if (id >= db->nbasenames)
+        return (-1);
+    off = get_le32(db->basenames + (size_t)(id / DB4_BLOCK) * 4);
+    if (off >= db->bndata_size)
+        return (-1);
+    c->p = db->bndata + off;
+    c->id = id - id % DB4_BLOCK;
+    c->len = 0;
+
+    return (0);
+}
+
+/* Decode the next basename of c into its name */
+static int
+bn_next(const struct db4 *db, struct bn_cursor *c)
+{
+    const u_char *end = db->bndata + db->bndata_size;
+    uint32_t shared;
+    size_t n;
+
+    if (c->id >= db->nbasenames ||
+        (c->p = get_varint(c->p, end, &shared)) == NULL || c->p >= end ||
+        shared > c->len)
+        return (-1);
+    n = strlen((const char *)c->p);
+    if (shared + n >= sizeof(c->name))
+        return (-1);
+    memcpy(c->name + shared, c->p, n + 1);
+    c->len = shared + n;
+    c->p += n + 1;
+    c->id++;
+
+    return (0);
+}
+
+/*
+ * Decode the whole basename table, for the searches building the path
+ * of every file. Returns -1 if it is corrupted.
+ */
+static int
+bns_load(struct db4 *db)
+{
+    struct bn_cursor c;
+    uint32_t *tab;
+    char *buf;
+    size_t len = 0, cap;
+    uint32_t i;
+
+    if (db->bntab != NULL)
+        return (0);
+    cap = db->bndata_size * 2 + 1;
+    tab = malloc(((size_t)db->nbasenames + 1) * sizeof(uint32_t));
+    buf = malloc(cap);
+    if (tab == NULL || buf == NULL)
+        exit(ENOMEM);
+    if (db->nbasenames > 0 && bn_seek(db, &c, 0) != 0)
+        goto corrupted;
+    for (i = 0; i < db->nbasenames; i++) {
+        if (bn_next(db, &c) != 0)
+            goto corrupted;
+        if (cap - len <= c.len) {
+            cap = cap * 2 + c.len;
+            if ((buf = realloc(buf, cap)) == NULL)
+                exit(ENOMEM);
+        }
+        tab[i] = len;
+        memcpy(buf + len, c.name, c.len + 1);
+        len += c.len + 1;
+    }
+    tab[i] = len;
+    db->bntab = tab;
+    db->bnbuf = buf;
+
+    return (0);
+
+corrupted:
+    free(tab);
+    free(buf);
+    return (-1);
+}
+
+/* Decode basename id into c->name, NULL if the table is corrupted */
+static const char *
+bn_get(const struct db4 *db, struct bn_cursor *c, uint32_t id)
+{
+    if (db->bntab != NULL) {
+        if (id >= db->nbasenames)
+            return (NULL);
+        c->len = db->bntab[id + 1] - db->bntab[id] - 1;
+        return (db->bnbuf + db->bntab[id]);
+    }
+    /* the next one of the block or the last one, as often */
+    if (c->p == NULL || id + 1 < c->id ||
+        id / DB4_BLOCK != (c->id - 1) / DB4_BLOCK) {
+        if (bn_seek(db, c, id) != 0)
+            return (NULL);
+    }
+    while (c->id <= id)
+        if (bn_next(db, c) != 0)
+            return (NULL);
+
+    return (c->name);
+}
+
+static void
+iter_init(struct db4_iter *it, const struct db4 *db)
+{
+    it->db = db;
+    it->p = it->end = NULL;
+    it->left = 0;
+    it->pathdir = UINT32_MAX;
+    it->bn.p = NULL;
+}
+
+static int
+iter_package(struct db4_iter *it, uint32_t pkg)
+{
+    const u_char *p = it->db->packages + (size_t)pkg * DB4_PACKAGE_SIZE;
+    uint64_t off = get_le64(p + 8);
+
+    if (off > it->db->records_size)
+        return (-1);
+    it->p = it->db->records + off;
+    it->end = it->db->records + it->db->records_size;
+    it->left = get_le32(p + 4);
+    it->dir = 0;
+
+    return (0);
+}
+
+/* Decode the next file of the package, returns 0 at its end, -1 on error */
+static int
+iter_next(struct db4_iter *it)
+{
+    uint32_t delta, basename;
+
+    if (it->left == 0)
+        return (0);
+    if ((it->p = get_varint(it->p, it->end, &delta)) == NULL ||
+        (it->p = get_varint(it->p, it->end, &basename)) == NULL)
+        return (-1);
+    /* zigzag, the ids wrap around like the encoder's */
+    it->dir += (delta >> 1) ^ -(delta & 1);
+    if (it->dir >= it->db->ndirs || basename >= it->db->nbasenames)
+        return (-1);
+    it->basename = basename;
+    it->left--;
+
+    return (1);
+}
+
+/* Build the path of the current file, NULL if the database is corrupted */
+static const char *
+iter_path(struct db4_iter *it, size_t *len)
+{
+    const char *name;
+    uint32_t parent;
+    size_t n, base;
+    int r;
+
+    if (it->dir != it->pathdir && it->dir == 0) {
+        it->dirlen = 0;
+        it->pathdir = 0;
+        it->pathparent = UINT32_MAX;
+    } else if (it->dir != it->pathdir) {
+        if (dir_entry(it->db, it->dir, &parent, &name) != 0)
+            return (NULL);
+        /* the files are sorted, mostly a child or a sibling follows */
+        if (it->pathdir != UINT32_MAX && parent == it->pathdir) {
+            base = it->dirlen;
+        } else if (it->pathdir != UINT32_MAX && parent == it->pathparent) {
+            base = it->parentlen;
+        } else {
+            if ((r = dir_path(it->db, parent, it->path,
+                sizeof(it->path))) < 0)
+                return (NULL);
+            base = r;
+        }
+        n = strlen(name);
+        if (base + n + 1 >= sizeof(it->path))
+            return (NULL);
+        it->path[base] = '/';
+        memcpy(it->path + base + 1, name, n);
+        it->dirlen = base + 1 + n;
+        it->parentlen = base;
+        it->pathparent = parent;
+        it->pathdir = it->dir;
+    }
+    if ((name = bn_get(it->db, &it->bn, it->basename)) == NULL)
+        return (NULL);
+    n = it->bn.len;
+    if (it->dirlen + n + 1 >= sizeof(it->path))
+        return (NULL);
+    it->path[it->dirlen] = '/';
+    memcpy(it->path + it->dirlen + 1, name, n + 1);
+    *len = it->dirlen + 1 + n;
+
+    return (it->path);
+}
+
+/* Add the current file of it, of package pkg, to the results */
+static int
+add_file(struct search_t *search, struct db4_iter *it, uint32_t pkg)
+{
+    const char *name, *path;
+    size_t len;
+
+    if ((name = package_name(it->db, pkg)) == NULL ||
+        (path = iter_path(it, &len)) == NULL)
+        return (-1);
+    search_add_file(search, name, strlen(name), path);
+
+    return (0);
+}
+
+static void
+result_add(struct db4_result *res, uint32_t pkg, uint32_t dir,
+    uint32_t basename)
+{
+    uint32_t *files;
+    size_t cap;
+
+    if (res->cap - res->len < 3) {
+        cap = res->cap ? res->cap * 2 : 384;
+        if ((files = realloc(res->files, cap * sizeof(uint32_t))) == NULL)
+            exit(ENOMEM);
+        res->files = files;
+        res->cap = cap;
+    }
+    res->files[res->len++] = pkg;
+    res->files[res->len++] = dir;
+    res->files[res->len++] = basename;
+}
+
+/* Match the basenames of the tasks against the pattern */
+static void *
+basename_worker(void *arg)
+{
+    struct db4_pool *pool = arg;
+    struct db4 *db = pool->db;
+    struct bn_cursor c;
+    struct matcher m;
+    unsigned int k;
+    uint32_t i, last;
+
+    if (matcher_init(&m, pool->search) != 0)
+        exit(ENOMEM);
+
+    while (!pool->error &&
+        (k = atomic_fetch_add(&pool->next, 1)) < pool->ntasks) {
+        i = k * TASK_BASENAMES;
+        last = MIN((uint64_t)i + TASK_BASENAMES, db->nbasenames);
+        if (bn_seek(db, &c, i) != 0)
+            pool->error = 1;
+        for (; !pool->error && i < last; i++) {
+            if (bn_next(db, &c) != 0) {
+                pool->error = 1;
+                break;
+            }
+            pool->hits[i] = match_path(pool->search, &m, c.name, c.len);
+        }
+    }
+
+    stats_merge(&m.stats);
+    matcher_free(&m);
+    return (NULL);
+}
+
+/* Decode the files of the tasks and keep the matching ones */
+static void *
+file_worker(void *arg)
+{
+    struct db4_pool *pool = arg;
+    struct db4_iter it;
+    struct matcher m;
+    const char *path;
+    size_t len;
+    unsigned int k;
+    uint32_t pkg;
+    uint64_t start = 0;
+    int r = 0;
+
+    if (stats_enabled)
+        start = stats_now();
+    if (matcher_init(&m, pool->search) != 0)
+        exit(ENOMEM);
+    iter_init(&it, pool->db);
+
+    while (!pool->error &&
+        (k = atomic_fetch_add(&pool->next, 1)) < pool->ntasks) {
+        for (pkg = pool->tasks[k]; r >= 0 && pkg < pool->tasks[k + 1];
+            pkg++) {
+            if (iter_package(&it, pkg) != 0) {
+                r = -1;
+                break;
+            }
+            while ((r = iter_next(&it)) > 0) {
+                m.stats.entries++;
+                if (pool->hits != NULL) {
+                    if (!pool->hits[it.basename])
+                        continue;
+                } else {
+                    if ((path = iter_path(&it, &len)) == NULL) {
+                        r = -1;
+                        break;
+                    }
+                    if (!match_path(pool->search, &m, path, len))
+                        continue;
+                }
+                result_add(&pool->results[k], pkg, it.dir, it.basename);
+            }
+        }
+        if (r < 0)
+            pool->error = 1;
+    }
+
+    if (stats_enabled)
+        m.stats.ns[STATS_DECODE] = stats_now() - start -
+            m.stats.ns[STATS_REGEX];
+    stats_merge(&m.stats);
+    matcher_free(&m);
+    return (NULL);
+}
+
+/* Run worker over the ntasks tasks of pool on config_jobs() threads */
+static void
+pool_run(struct db4_pool *pool, void *(*worker)(void *), uint32_t ntasks)
+{
+    pthread_t *threads;
+    int njobs, started;
+
+    atomic_store(&pool->next, 0);
+    pool->ntasks = ntasks;
+
+    njobs = config_jobs();
+    if (njobs > (int)ntasks)
+        njobs = ntasks;
+    if (njobs <= 1) {
+        worker(pool);
+        return;
+    }
+
+    if ((threads = calloc(njobs, sizeof(pthread_t))) == NULL)
+        exit(ENOMEM);
+    for (started = 0; started < njobs; started++)
+        if (pthread_create(&threads[started], NULL, worker, pool) != 0)
+            break;
+    if (started == 0)
+        worker(pool);
+    while (started > 0)
+        pthread_join(threads[--started], NULL);
+    free(threads);
+}
+
+/*
+ * Search the database for the pattern of search.
+ * Returns -1 if the database is corrupted.
+ */
+int
+db4_search(struct db4 *db, struct search_t *search)
+{
+    struct db4_pool pool;
+    struct db4_iter it;
+    uint64_t files;
+    uint32_t i, j, nhits;
+    size_t k;
+    int ret = 0;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.db = db;
+    pool.search = search;
+    atomic_init(&pool.error, 0);
+
+    if (search->basename) {
+        /* only the basenames can match, match each of them once */
+        if ((pool.hits = calloc(db->nbasenames + 1, 1)) == NULL)
+            exit(ENOMEM);
+        pool_run(&pool, basename_worker,
+            howmany((uint64_t)db->nbasenames, TASK_BASENAMES));
+        for (i = 0, nhits = 0; i < db->nbasenames; i++)
+            nhits += pool.hits[i];
+        if (pool.error || nhits == 0) {
+            free(pool.hits);
+            return (pool.error ? -1 : 0);
+        }
+    } else if (dirs_load(db) != 0 || bns_load(db) != 0) {
+        return (-1);
+    }
+
+    /* cut the packages in tasks of about TASK_FILES files */
+    if ((pool.tasks = malloc((db->npackages + 1) * sizeof(uint32_t))) == NULL)
+        exit(ENOMEM);
+    for (i = 0, j = 0, files = 0; i < db->npackages; i++) {
+        if (i == 0 || files >= TASK_FILES) {
+            pool.tasks[j++] = i;
+            files = 0;
+        }
+        files += get_le32(db->packages + (size_t)i * DB4_PACKAGE_SIZE + 4);
+    }
+    pool.tasks[j] = db->npackages;
+    if ((pool.results = calloc(j + 1, sizeof(struct db4_result))) == NULL)
+        exit(ENOMEM);
+
+    search->matcher.stats.bytes += db->records_size;
+    pool_run(&pool, file_worker, j);
+    if (pool.error)
+        ret = -1;
+
+    /* merge in database order */
+    iter_init(&it, db);
+    for (i = 0; i < j; i++) {
+        for (k = 0; ret == 0 && k < pool.results[i].len; k += 3) {
+            it.dir = pool.results[i].files[k + 1];
+            it.basename = pool.results[i].files[k + 2];
+            ret = add_file(search, &it, pool.results[i].files[k]);
+        }
+        free(pool.results[i].files);
+    }
+
+    free(pool.results);
+    free(pool.tasks);
+    free(pool.hits);
+
+    return (ret);
+}
+
+/* Compare package names like their "name*" entries in a v3 database */
+static int
+package_cmp(const char *a, const char *b)
+{
+    while (*a != '\0' && *a == *b) {
+        a++;
+        b++;
+    }
+    return ((u_char)(*a ? *a : '*') - (u_char)(*b ? *b : '*'));
+}
+
+/*
+ * Collect the files of package name, found by binary search in the
+ * package table. Returns -1 if the database is corrupted.
+ */
+int
+db4_package(struct db4 *db, struct search_t *search, const char *name)
+{
+    struct db4_iter it;
+    const char *s;
+    const u_char *start;
+    uint32_t lo = 0, hi = db->npackages, mid;
+    int c, r;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if ((s = package_name(db, mid)) == NULL)
+            return (-1);
+        if ((c = package_cmp(s, name)) == 0)
+            break;
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo >= hi)
+        return (0);
+
+    iter_init(&it, db);
+    if (iter_package(&it, mid) != 0)
+        return (-1);
+    start = it.p;
+    while ((r = iter_next(&it)) > 0) {
+        search->matcher.stats.entries++;
+        if (add_file(search, &it, mid) != 0)
+            return (-1);
+    }
+    search->matcher.stats.bytes += it.p - start;
+
+    return (r);
+}
+
+/* Binary search of the directory path, UINT32_MAX if there is none */
+static uint32_t
+dir_lookup(struct db4 *db, const char *path)
+{
+    char buf[MAXPATHLEN];
+    uint32_t lo = 0, hi = db->ndirs, mid;
+    int c;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (dir_path(db, mid, buf, sizeof(buf)) < 0)
+            return (UINT32_MAX);
+        if ((c = strcmp(buf, path)) == 0)
+            return (mid);
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (UINT32_MAX);
+}
+
+/* Binary search of the basename, UINT32_MAX if there is none */
+static uint32_t
+basename_lookup(struct db4 *db, const char *name)
+{
+    struct bn_cursor c;
+    uint32_t lo = 0, hi = howmany((uint64_t)db->nbasenames, DB4_BLOCK), mid;
+    int r;
+
+    /* the last block whose first basename is not after name */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (bn_seek(db, &c, mid * DB4_BLOCK) != 0 || bn_next(db, &c) != 0)
+            return (UINT32_MAX);
+        if (strcmp(c.name, name) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0 || bn_seek(db, &c, (lo - 1) * DB4_BLOCK) != 0)
+        return (UINT32_MAX);
+
+    while (c.id < lo * DB4_BLOCK && bn_next(db, &c) == 0) {
+        if ((r = strcmp(c.name, name)) == 0)
+            return (c.id - 1);
+        if (r > 0)
+            break;
+    }
+
+    return (UINT32_MAX);
+}
+
+/*
+ * Collect the files whose path is key, or whose basename is key when it
+ * has no '/'. The key is turned into ids and the records compared on
+ * them. Returns -1 if the database is corrupted.
+ */
+int
+db4_exact(struct db4 *db, struct search_t *search, const char *key)
+{
+    struct db4_iter it;
+    char dir[MAXPATHLEN];
+    const char *name;
+    uint32_t dirid = UINT32_MAX, basename, pkg;
+    int r = 0;
+
+    if ((name = strrchr(key, '/')) != NULL) {
+        if ((size_t)(name - key) >= sizeof(dir))
+            return (0);
+        memcpy(dir, key, name - key);
+        dir[name - key] = '\0';
+        if ((dirid = dir_lookup(db, dir)) == UINT32_MAX)
+            return (0);
+        name++;
+    } else {
+        name = key;
+    }
+    if ((basename = basename_lookup(db, name)) == UINT32_MAX)
+        return (0);
+
+    search->matcher.stats.bytes += db->records_size;
+    iter_init(&it, db);
+    for (pkg = 0; r == 0 && pkg < db->npackages; pkg++) {
+        if (iter_package(&it, pkg) != 0)
+            return (-1);
+        while ((r = iter_next(&it)) > 0) {
+            search->matcher.stats.entries++;
+            if (it.basename == basename &&
+                (dirid == UINT32_MAX || it.dir == dirid) &&
+                add_file(search, &it, pkg) != 0)
+                return (-1);
+        }
+    }
+
+    return (r);
+}
+
+/*
+ * Pass every file of the database to match_cb as a v3 "pkgname*path"
+ * line. Returns -1 if the database is corrupted.
+ */
+int
+db4_expand(struct db4 *db, void (*match_cb)(const char *, void *),
+    void *extra)
+{
+    struct db4_iter it;
+    char line[MAXPATHLEN * 2];
+    const char *name, *path;
+    size_t n, len;
+    uint32_t pkg;
+    int r = 0;
+
+    if (dirs_load(db) != 0 || bns_load(db) != 0)
+        return (-1);
+    iter_init(&it, db);
+    for (pkg = 0; r == 0 && pkg < db->npackages; pkg++) {
+        if ((name = package_name(db, pkg)) == NULL ||
+            iter_package(&it, pkg) != 0)
+            return (-1);
+        n = strlen(name);
+        if (n >= MAXPATHLEN)
+            return (-1);
+        memcpy(line, name, n);
+        line[n] = '*';
+        while ((r = iter_next(&it)) > 0) {
+            if ((path = iter_path(&it, &len)) == NULL)
+                return (-1);
+            memcpy(line + n + 1, path, len + 1);
+            match_cb(line, extra);
+        }
+    }
+
+    return (r);
+}
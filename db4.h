@@ -0,0 +1,83 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Layout of the v4 provides database, shared by the plugin and
+ * provides-db-gen. Integers are little-endian.
+ *
+ *	magic
+ *	directories	nblocks x { u32 offset } then the entries
+ *	basenames	nblocks x { u32 offset } then the entries
+ *	records		varints, the files of each package in turn
+ *	packages	npackages x { u32 name, u32 nfiles, u64 records }
+ *			then the names
+ *	trailer
+ *
+ * Directories and basenames are cut in blocks of DB4_BLOCK entries, the
+ * offset of each block being relative to the first entry of the section,
+ * so an id is found by decoding at most a block. A directory entry is a
+ * varint, its id minus the id of its parent, then its name. Directory 0
+ * is the root, whose name is empty, and the path of a directory is the
+ * path of its parent, '/' and its name. A basename entry is a varint,
+ * the length of the prefix it shares with the previous basename of its
+ * block, then the rest of the name. Names are NUL terminated.
+ *
+ * Directories are sorted by path and basenames by name, so each can be
+ * looked up by binary search. Packages are in the order of their
+ * "name*" entries in a v3 database, the offset of their name being
+ * relative to the first name and the one of their records relative to
+ * the records section.
+ *
+ * A file is two varints: its directory, zigzag coded as the difference
+ * with the directory of the previous file of the package, then its
+ * basename. Its path is the path of the directory, '/' and the
+ * basename. The files of a package are sorted by path.
+ *
+ * The trailer holds the offsets of the sections, so the database can be
+ * written in a single pass.
+ */
+
+#ifndef _DB4_H_
+#define _DB4_H_
+
+#define DB4_MAGIC           "PRVDDB4\n"
+#define DB4_MAGIC_SIZE      8
+
+#define DB4_TRAILER_SIZE    64
+#define DB4_T_DIRS          0       /* u64 offsets of the sections */
+#define DB4_T_BASENAMES     8
+#define DB4_T_RECORDS       16
+#define DB4_T_PACKAGES      24
+#define DB4_T_NDIRS         32      /* u32 */
+#define DB4_T_NBASENAMES    36      /* u32 */
+#define DB4_T_NPACKAGES     40      /* u32 */
+#define DB4_T_NFILES        48      /* u64 */
+#define DB4_T_MAGIC         56
+
+#define DB4_BLOCK           16      /* directories or basenames */
+#define DB4_PACKAGE_SIZE    16
+
+#endif /* _DB4_H_ */
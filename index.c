@@ -0,0 +1,1457 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Trigram index of the provides database (provides.idx).
+ *
+ * The database is cut in blocks of INDEX_BLOCK entries. For each block
+ * the index records the byte offset of its first entry and the state
+ * of the front-coding decoder at that point, so a block can be decoded
+ * on its own. Each trigram found in the file paths of the database is
+ * mapped to the list of blocks containing it, stored as delta encoded
+ * varints.
+ *
+ * The entries of a package are contiguous in the database, the package
+ * table records for each run of entries of a package the decoder state
+ * at its first entry, so the files of a package are decoded without
+ * scanning the database.
+ *
+ * Exact lookups go through two hash tables, of the file paths and of
+ * their basenames. The decoder state is also saved every INDEX_ANCHOR
+ * entries, the hash tables map a key to the anchors followed by an
+ * entry having it, so a lookup decodes a few entries whatever the size
+ * of the packages.
+ *
+ * All integers are little-endian:
+ *
+ *  header      magic, version, identity of provides.db, counts and
+ *              offsets of the sections below
+ *  blocks      nblocks x { u64 offset, u32 count, u32 len, u64 path }
+ *  trigrams    ntrigrams x { u32 trigram, u32 nblocks, u64 postings },
+ *              sorted by trigram
+ *  postings    varint lists of block numbers
+ *  packages    npackages x { u64 name, u32 name_len, u32 nentries,
+ *              u64 offset, u64 end, u32 count, u32 len, u64 path },
+ *              sorted by name
+ *  anchors     nanchors x { u64 offset, u32 count, u32 len, u64 path }
+ *  paths       hash table of the file paths
+ *  basenames   hash table of the file basenames
+ *  names       ngroups x { u32 offset } then for each distinct basename
+ *              its name, NUL terminated, the varint count of its anchors
+ *              and their delta encoded numbers
+ *  strings     decoder paths and package names referenced above
+ *
+ * Both hash tables have 2^hash_bits buckets: a directory of nbuckets + 1
+ * u32 indexes followed by the { u32 fingerprint, u32 anchor } entries,
+ * grouped by bucket and sorted. The low bits of the 64-bit hash of a key
+ * select its bucket, the high 32 bits are its fingerprint. The entries
+ * decoded from the anchors are compared to the key, a fingerprint
+ * collision costs a decode, never a wrong answer.
+ *
+ * A pattern without '/' only matches basenames. The names section lists
+ * each distinct basename once, sorted, with the anchors followed by an
+ * entry having it, so such a pattern is matched against the names and
+ * only the anchors of the matching ones are decoded. The names are cut
+ * in groups of NAME_GROUP, matched in parallel, the offsets of the
+ * groups relative to the first name coming first.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bigram.h"
+#include "provides.h"
+
+#define INDEX_MAGIC     "PRVDIDX"
+#define INDEX_VERSION   4
+#define INDEX_BLOCK     4096        /* entries per block */
+#define INDEX_ANCHOR    128         /* entries per anchor */
+#define NAME_GROUP      1024        /* names per group */
+
+#define HDR_SIZE        152
+#define BLOCK_SIZE      24
+#define TRIGRAM_SIZE    16
+#define PACKAGE_SIZE    48
+#define HASH_ENTRY_SIZE 8
+#define HASH_LOAD       4           /* mean entries per bucket */
+
+#define TRIGRAM(p)  ((uint32_t)LOWER((p)[0]) << 16 | \
+                     (uint32_t)LOWER((p)[1]) << 8 | LOWER((p)[2]))
+
+struct posting {
+    uint32_t trigram;
+    uint32_t last;                  /* last block added */
+    uint32_t n;                     /* 0 for an empty slot */
+    u_char *buf;
+    size_t len;
+    size_t cap;
+};
+
+struct trigram_table {
+    struct posting *slots;
+    size_t size;                    /* power of 2 */
+    size_t used;
+};
+
+struct block {
+    uint64_t off;
+    uint32_t count;
+    uint32_t len;
+    uint64_t path;
+};
+
+/* a run of entries of the same package */
+struct package {
+    uint64_t name;
+    uint32_t name_len;
+    uint32_t nentries;
+    struct block start;
+    uint64_t end;
+};
+
+struct hash_entry {
+    uint32_t fingerprint;
+    uint32_t anchor;
+};
+
+struct hash_table {
+    uint32_t *dir;                  /* nbuckets + 1 */
+    struct hash_entry *entries;
+};
+
+struct name {
+    uint64_t off;                   /* in the buffer of the table */
+    uint32_t len;
+    uint32_t hash;
+    uint32_t nanchors;
+    uint32_t last;                  /* last anchor added + 1 */
+    uint64_t pos;                   /* of its anchors, while sorting them */
+};
+
+/* the distinct basenames and the basename of each entry */
+struct name_table {
+    uint32_t *slots;                /* name number + 1, 0 when empty */
+    size_t size;                    /* power of 2 */
+    struct name *names;
+    uint32_t nnames;
+    uint32_t cap;
+    char *buf;                      /* the names, NUL terminated */
+    size_t len;
+    size_t buf_cap;
+    uint32_t *entries;
+    uint64_t nentries;
+    uint64_t entries_cap;
+};
+
+/* what index_write() needs to sort the packages by name */
+static const u_char *sort_strings;
+
+/* what names_write() needs to sort the names */
+static const struct name_table *sort_names;
+
+static size_t
+put_varint(u_char *p, uint32_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+
+    return (n);
+}
+
+static const u_char *
+get_varint(const u_char *p, const u_char *end, uint32_t *v)
+{
+    int shift;
+
+    *v = 0;
+    for (shift = 0; p < end && shift < 32; shift += 7) {
+        *v |= (uint32_t)(*p & 0x7f) << shift;
+        if ((*p++ & 0x80) == 0)
+            return (p);
+    }
+
+    return (NULL);
+}
+
+static struct posting *
+table_lookup(struct trigram_table *t, uint32_t trigram)
+{
+    size_t i;
+
+    i = (trigram * 0x9E3779B1u) & (t->size - 1);
+    while (t->slots[i].n != 0 && t->slots[i].trigram != trigram)
+        i = (i + 1) & (t->size - 1);
+
+    return (&t->slots[i]);
+}
+
+static int
+table_grow(struct trigram_table *t)
+{
+    struct trigram_table nt;
+    struct posting *slot;
+    size_t i;
+
+    nt.size = t->size ? t->size * 2 : 65536;
+    nt.used = t->used;
+    nt.slots = calloc(nt.size, sizeof(struct posting));
+    if (nt.slots == NULL)
+        return (-1);
+
+    for (i = 0; i < t->size; i++) {
+        if (t->slots[i].n == 0)
+            continue;
+        slot = table_lookup(&nt, t->slots[i].trigram);
+        *slot = t->slots[i];
+    }
+    free(t->slots);
+    *t = nt;
+
+    return (0);
+}
+
+static int
+table_add(struct trigram_table *t, uint32_t trigram, uint32_t block)
+{
+    struct posting *slot;
+    u_char *buf;
+
+    slot = table_lookup(t, trigram);
+    if (slot->n == 0) {
+        if (2 * (t->used + 1) > t->size) {
+            if (table_grow(t) != 0)
+                return (-1);
+            slot = table_lookup(t, trigram);
+        }
+        slot->trigram = trigram;
+        t->used++;
+    } else if (slot->last == block) {
+        return (0);
+    }
+
+    if (slot->cap - slot->len < 5) {
+        buf = realloc(slot->buf, slot->cap ? slot->cap * 2 : 8);
+        if (buf == NULL)
+            return (-1);
+        slot->buf = buf;
+        slot->cap = slot->cap ? slot->cap * 2 : 8;
+    }
+    slot->len += put_varint(slot->buf + slot->len,
+        slot->n ? block - slot->last : block);
+    slot->last = block;
+    slot->n++;
+
+    return (0);
+}
+
+static void
+table_free(struct trigram_table *t)
+{
+    size_t i;
+
+    for (i = 0; i < t->size; i++)
+        free(t->slots[i].buf);
+    free(t->slots);
+}
+
+static int
+posting_cmp(const void *a, const void *b)
+{
+    const struct posting *pa = a, *pb = b;
+
+    if (pa->trigram == pb->trigram)
+        return (0);
+    return (pa->trigram < pb->trigram ? -1 : 1);
+}
+
+/* FNV-1a followed by the murmur3 finalizer to spread the low bits */
+static uint64_t
+hash_key(const char *s, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (len-- > 0) {
+        h ^= (u_char)*s++;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (h);
+}
+
+/* the path and basename keys of an entry */
+static void
+entry_keys(const char *path, const char **p, size_t *plen, const char **b,
+    size_t *blen)
+{
+    const char *sep, *slash;
+
+    sep = strchr(path, '*');
+    *p = sep ? sep + 1 : path;
+    *plen = strlen(*p);
+    slash = strrchr(*p, '/');
+    *b = slash ? slash + 1 : *p;
+    *blen = *plen - (*b - *p);
+}
+
+static int
+hash_entry_cmp(const void *a, const void *b)
+{
+    const struct hash_entry *ea = a, *eb = b;
+
+    if (ea->fingerprint != eb->fingerprint)
+        return (ea->fingerprint < eb->fingerprint ? -1 : 1);
+    if (ea->anchor != eb->anchor)
+        return (ea->anchor < eb->anchor ? -1 : 1);
+    return (0);
+}
+
+/*
+ * Fill the path and basename hash tables, in two passes over the
+ * database: the first one sizes the buckets, the second one stores
+ * the entries.
+ */
+static int
+hash_build(struct bigram_iter *it, uint32_t nbuckets,
+    struct hash_table *tables)
+{
+    struct hash_entry *e;
+    uint32_t *pos[2] = { NULL, NULL };
+    uint32_t entry, b, i, j, n;
+    uint64_t h[2];
+    size_t len[2];
+    const char *key[2];
+    int pass, k, r, ret = -1;
+
+    for (k = 0; k < 2; k++) {
+        tables[k].dir = calloc(nbuckets + 1, sizeof(uint32_t));
+        pos[k] = malloc((nbuckets + 1) * sizeof(uint32_t));
+        if (tables[k].dir == NULL || pos[k] == NULL)
+            goto done;
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        if (bigram_iter_seek(it, 2 * NBG, it->size, 0, "", 0) != 0)
+            goto done;
+        for (entry = 0;; entry++) {
+            if ((r = bigram_iter_next(it)) <= 0) {
+                if (r < 0)
+                    goto done;
+                break;
+            }
+            entry_keys((char *)it->path, &key[0], &len[0], &key[1], &len[1]);
+            for (k = 0; k < 2; k++) {
+                h[k] = hash_key(key[k], len[k]);
+                b = h[k] & (nbuckets - 1);
+                if (pass == 0) {
+                    tables[k].dir[b + 1]++;
+                } else {
+                    e = &tables[k].entries[pos[k][b]++];
+                    e->fingerprint = h[k] >> 32;
+                    e->anchor = entry / INDEX_ANCHOR;
+                }
+            }
+        }
+        if (pass > 0)
+            break;
+
+        for (k = 0; k < 2; k++) {
+            for (b = 0; b < nbuckets; b++)
+                tables[k].dir[b + 1] += tables[k].dir[b];
+            memcpy(pos[k], tables[k].dir, (nbuckets + 1) * sizeof(uint32_t));
+            tables[k].entries = malloc(
+                (tables[k].dir[nbuckets] + 1) * sizeof(struct hash_entry));
+            if (tables[k].entries == NULL)
+                goto done;
+        }
+    }
+
+    /* one entry per fingerprint and anchor in each bucket */
+    for (k = 0; k < 2; k++) {
+        for (b = 0, n = 0; b < nbuckets; b++) {
+            e = tables[k].entries + tables[k].dir[b];
+            i = tables[k].dir[b + 1] - tables[k].dir[b];
+            qsort(e, i, sizeof(struct hash_entry), hash_entry_cmp);
+            tables[k].dir[b] = n;
+            for (j = 0; j < i; j++) {
+                if (j > 0 && hash_entry_cmp(&e[j], &e[j - 1]) == 0)
+                    continue;
+                tables[k].entries[n++] = e[j];
+            }
+        }
+        tables[k].dir[nbuckets] = n;
+    }
+    ret = 0;
+
+done:
+    free(pos[0]);
+    free(pos[1]);
+    return (ret);
+}
+
+static int
+hash_write(FILE *fp, const struct hash_table *t, uint32_t nbuckets)
+{
+    u_char rec[HASH_ENTRY_SIZE];
+    uint32_t i;
+
+    for (i = 0; i <= nbuckets; i++) {
+        put_le32(rec, t->dir[i]);
+        if (fwrite(rec, 4, 1, fp) != 1)
+            return (-1);
+    }
+    for (i = 0; i < t->dir[nbuckets]; i++) {
+        put_le32(rec, t->entries[i].fingerprint);
+        put_le32(rec + 4, t->entries[i].anchor);
+        if (fwrite(rec, HASH_ENTRY_SIZE, 1, fp) != 1)
+            return (-1);
+    }
+
+    return (0);
+}
+
+static int
+names_grow(struct name_table *t)
+{
+    uint32_t *slots;
+    size_t size, i, j;
+
+    size = t->size ? t->size * 2 : 65536;
+    if ((slots = calloc(size, sizeof(uint32_t))) == NULL)
+        return (-1);
+    for (i = 0; i < t->nnames; i++) {
+        j = t->names[i].hash & (size - 1);
+        while (slots[j] != 0)
+            j = (j + 1) & (size - 1);
+        slots[j] = i + 1;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->size = size;
+
+    return (0);
+}
+
+/* Record name, len bytes long, as the basename of the next entry */
+static int
+names_add(struct name_table *t, const char *name, size_t len)
+{
+    struct name *n;
+    uint32_t h;
+    size_t i, cap;
+    void *p;
+
+    if (t->size == 0 && names_grow(t) != 0)
+        return (-1);
+
+    h = hash_key(name, len);
+    for (i = h & (t->size - 1); t->slots[i] != 0;
+        i = (i + 1) & (t->size - 1)) {
+        n = &t->names[t->slots[i] - 1];
+        if (n->hash == h && n->len == len &&
+            memcmp(t->buf + n->off, name, len) == 0)
+            break;
+    }
+
+    if (t->slots[i] == 0) {
+        /* a new name */
+        if (2 * ((size_t)t->nnames + 1) > t->size) {
+            if (names_grow(t) != 0)
+                return (-1);
+            for (i = h & (t->size - 1); t->slots[i] != 0;
+                i = (i + 1) & (t->size - 1))
+                ;
+        }
+        if (t->nnames == t->cap) {
+            cap = t->cap ? t->cap * 2 : 65536;
+            if ((p = realloc(t->names, cap * sizeof(struct name))) == NULL)
+                return (-1);
+            t->names = p;
+            t->cap = cap;
+        }
+        if (t->buf_cap - t->len <= len) {
+            cap = t->buf_cap * 2 + len + MAXPATHLEN;
+            if ((p = realloc(t->buf, cap)) == NULL)
+                return (-1);
+            t->buf = p;
+            t->buf_cap = cap;
+        }
+        n = &t->names[t->nnames];
+        memset(n, 0, sizeof(*n));
+        n->off = t->len;
+        n->len = len;
+        n->hash = h;
+        memcpy(t->buf + t->len, name, len);
+        t->buf[t->len + len] = '\0';
+        t->len += len + 1;
+        t->slots[i] = ++t->nnames;
+    }
+
+    if (t->nentries == t->entries_cap) {
+        cap = t->entries_cap ? t->entries_cap * 2 : 65536;
+        if ((p = realloc(t->entries, cap * sizeof(uint32_t))) == NULL)
+            return (-1);
+        t->entries = p;
+        t->entries_cap = cap;
+    }
+    t->entries[t->nentries++] = t->slots[i] - 1;
+
+    return (0);
+}
+
+static int
+name_cmp(const void *a, const void *b)
+{
+    const struct name *na = &sort_names->names[*(const uint32_t *)a];
+    const struct name *nb = &sort_names->names[*(const uint32_t *)b];
+
+    return (strcmp(sort_names->buf + na->off, sort_names->buf + nb->off));
+}
+
+/*
+ * Encode the names section of the table into a buffer allocated in
+ * data, of size bytes.
+ */
+static int
+names_write(struct name_table *t, u_char **data, size_t *size)
+{
+    struct name *n;
+    uint32_t *order = NULL, *anchors = NULL;
+    uint32_t i, a, ngroups;
+    uint64_t e, j, total;
+    u_char *out = NULL, *names, *p;
+    int ret = -1;
+
+    /* the anchors of each name, each one once */
+    for (e = 0, total = 0; e < t->nentries; e++) {
+        n = &t->names[t->entries[e]];
+        a = e / INDEX_ANCHOR;
+        if (n->last != a + 1) {
+            n->last = a + 1;
+            n->nanchors++;
+            total++;
+        }
+    }
+
+    order = malloc(((size_t)t->nnames + 1) * sizeof(uint32_t));
+    anchors = malloc((total + 1) * sizeof(uint32_t));
+    if (order == NULL || anchors == NULL)
+        goto done;
+    for (i = 0; i < t->nnames; i++)
+        order[i] = i;
+    sort_names = t;
+    qsort(order, t->nnames, sizeof(uint32_t), name_cmp);
+
+    for (i = 0, total = 0; i < t->nnames; i++) {
+        n = &t->names[order[i]];
+        n->pos = total;
+        n->last = 0;
+        total += n->nanchors;
+    }
+    for (e = 0; e < t->nentries; e++) {
+        n = &t->names[t->entries[e]];
+        a = e / INDEX_ANCHOR;
+        if (n->last != a + 1) {
+            n->last = a + 1;
+            anchors[n->pos++] = a;
+        }
+    }
+
+    ngroups = howmany(t->nnames, NAME_GROUP);
+    out = malloc((size_t)ngroups * 4 + t->len + 5 * (t->nnames + total));
+    if (out == NULL)
+        goto done;
+    names = p = out + (size_t)ngroups * 4;
+    for (i = 0; i < t->nnames; i++) {
+        if (i % NAME_GROUP == 0) {
+            if ((uint64_t)(p - names) > UINT32_MAX)
+                goto done;
+            put_le32(out + (size_t)(i / NAME_GROUP) * 4, p - names);
+        }
+        n = &t->names[order[i]];
+        memcpy(p, t->buf + n->off, n->len + 1);
+        p += n->len + 1;
+        p += put_varint(p, n->nanchors);
+        /* pos is now past the anchors of the name */
+        for (j = n->pos - n->nanchors; j < n->pos; j++)
+            p += put_varint(p, j > n->pos - n->nanchors ?
+                anchors[j] - anchors[j - 1] : anchors[j]);
+    }
+    *data = out;
+    *size = p - out;
+    out = NULL;
+    ret = 0;
+
+done:
+    free(out);
+    free(order);
+    free(anchors);
+    return (ret);
+}
+
+static void
+names_free(struct name_table *t)
+{
+    free(t->slots);
+    free(t->names);
+    free(t->buf);
+    free(t->entries);
+}
+
+static int
+package_cmp(const void *a, const void *b)
+{
+    const struct package *pa = a, *pb = b;
+    size_t len = MIN(pa->name_len, pb->name_len);
+    int r;
+
+    r = memcmp(sort_strings + pa->name, sort_strings + pb->name, len);
+    if (r != 0)
+        return (r);
+    if (pa->name_len != pb->name_len)
+        return (pa->name_len < pb->name_len ? -1 : 1);
+    /* runs of a package stay in database order */
+    return (pa->start.off < pb->start.off ? -1 : 1);
+}
+
+static int
+block_write(FILE *fp, const struct block *blocks, uint32_t n)
+{
+    u_char rec[BLOCK_SIZE];
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        put_le64(rec, blocks[i].off);
+        put_le32(rec + 8, blocks[i].count);
+        put_le32(rec + 12, blocks[i].len);
+        put_le64(rec + 16, blocks[i].path);
+        if (fwrite(rec, BLOCK_SIZE, 1, fp) != 1)
+            return (-1);
+    }
+
+    return (0);
+}
+
+static int
+index_write(FILE *fp, const struct stat *sb, uint64_t nentries,
+    struct block *blocks, uint32_t nblocks, struct trigram_table *t,
+    struct package *packages, uint32_t npackages,
+    struct block *anchors, uint32_t nanchors,
+    const struct hash_table *tables, uint32_t hash_bits,
+    const u_char *names, size_t names_size, uint32_t nnames,
+    const u_char *strings, size_t strings_size)
+{
+    u_char hdr[HDR_SIZE], rec[PACKAGE_SIZE];
+    uint64_t off, postings_size;
+    uint32_t i, n;
+
+    /* compact the hash table into a sorted trigram array */
+    for (i = 0, n = 0; i < t->size; i++) {
+        if (t->slots[i].n == 0)
+            continue;
+        if (i != n) {
+            t->slots[n] = t->slots[i];
+            t->slots[i].buf = NULL;
+            t->slots[i].n = 0;
+        }
+        n++;
+    }
+    qsort(t->slots, n, sizeof(struct posting), posting_cmp);
+
+    postings_size = 0;
+    for (i = 0; i < n; i++)
+        postings_size += t->slots[i].len;
+
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    put_le32(hdr + 8, INDEX_VERSION);
+    put_le32(hdr + 12, INDEX_BLOCK);
+    put_le64(hdr + 16, sb->st_size);
+    put_le64(hdr + 24, sb->st_mtim.tv_sec);
+    put_le64(hdr + 32, sb->st_mtim.tv_nsec);
+    put_le64(hdr + 40, sb->st_ino);
+    sort_strings = strings;
+    qsort(packages, npackages, sizeof(struct package), package_cmp);
+
+    put_le64(hdr + 48, nentries);
+    put_le32(hdr + 56, nblocks);
+    put_le32(hdr + 60, n);
+    off = HDR_SIZE;
+    put_le64(hdr + 64, off);
+    off += (uint64_t)nblocks * BLOCK_SIZE;
+    put_le64(hdr + 72, off);
+    off += (uint64_t)n * TRIGRAM_SIZE;
+    put_le64(hdr + 80, off);
+    off += postings_size;
+    put_le64(hdr + 88, off);
+    off += (uint64_t)npackages * PACKAGE_SIZE;
+    put_le64(hdr + 112, off);
+    off += (uint64_t)nanchors * BLOCK_SIZE;
+    put_le64(hdr + 120, off);
+    off += ((uint64_t)1 << hash_bits) * 4 + 4 +
+        (uint64_t)tables[0].dir[(size_t)1 << hash_bits] * HASH_ENTRY_SIZE;
+    put_le64(hdr + 128, off);
+    off += ((uint64_t)1 << hash_bits) * 4 + 4 +
+        (uint64_t)tables[1].dir[(size_t)1 << hash_bits] * HASH_ENTRY_SIZE;
+    put_le64(hdr + 144, off);
+    off += names_size;
+    put_le64(hdr + 96, off);
+    put_le32(hdr + 104, npackages);
+    put_le32(hdr + 108, hash_bits);
+    put_le32(hdr + 136, nanchors);
+    put_le32(hdr + 140, nnames);
+
+    if (fwrite(hdr, sizeof(hdr), 1, fp) != 1)
+        return (-1);
+
+    if (block_write(fp, blocks, nblocks) != 0)
+        return (-1);
+
+    for (i = 0, off = 0; i < n; i++) {
+        put_le32(rec, t->slots[i].trigram);
+        put_le32(rec + 4, t->slots[i].n);
+        put_le64(rec + 8, off);
+        off += t->slots[i].len;
+        if (fwrite(rec, TRIGRAM_SIZE, 1, fp) != 1)
+            return (-1);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (fwrite(t->slots[i].buf, 1, t->slots[i].len, fp) !=
+            t->slots[i].len)
+            return (-1);
+    }
+
+    for (i = 0; i < npackages; i++) {
+        put_le64(rec, packages[i].name);
+        put_le32(rec + 8, packages[i].name_len);
+        put_le32(rec + 12, packages[i].nentries);
+        put_le64(rec + 16, packages[i].start.off);
+        put_le64(rec + 24, packages[i].end);
+        put_le32(rec + 32, packages[i].start.count);
+        put_le32(rec + 36, packages[i].start.len);
+        put_le64(rec + 40, packages[i].start.path);
+        if (fwrite(rec, PACKAGE_SIZE, 1, fp) != 1)
+            return (-1);
+    }
+
+    if (block_write(fp, anchors, nanchors) != 0 ||
+        hash_write(fp, &tables[0], 1U << hash_bits) != 0 ||
+        hash_write(fp, &tables[1], 1U << hash_bits) != 0)
+        return (-1);
+
+    if (names_size > 0 && fwrite(names, names_size, 1, fp) != 1)
+        return (-1);
+
+    if (strings_size > 0 && fwrite(strings, strings_size, 1, fp) != 1)
+        return (-1);
+
+    return (0);
+}
+
+/*
+ * Build the index of the database dbpath into idxpath.
+ * The index is written to a temporary file renamed over idxpath, so
+ * a concurrent search sees either the old or the new one.
+ * The whole index is held in memory until it is written, the hash
+ * tables alone take 16 bytes per entry before their duplicates are
+ * dropped: see pkg-provides(8) for the peak usage.
+ */
+int
+index_build(const char *dbpath, const char *idxpath)
+{
+    struct trigram_table t;
+    struct bigram_iter it;
+    struct block *blocks = NULL, *nb;
+    struct package *packages = NULL, *np, *pkg = NULL;
+    struct block *anchors = NULL;
+    struct hash_table tables[2];
+    struct name_table names;
+    uint32_t hash_bits;
+    struct stat sb;
+    u_char *strings = NULL, *ns, *db = MAP_FAILED, *namesdata = NULL;
+    size_t strings_size = 0, strings_cap = 0, i, start, name_len;
+    size_t names_size = 0, path_len, base_len;
+    uint64_t nentries = 0, prev_off;
+    uint32_t nblocks = 0, blocks_cap = 0, npackages = 0, packages_cap = 0;
+    uint32_t nanchors = 0, anchors_cap = 0;
+    int prev_count;
+    char tmppath[MAXPATHLEN];
+    const char *sep, *path, *base;
+    FILE *fp = NULL;
+    int fd, tmpfd = -1, tmpcreated = 0, ret = -1, r;
+
+    memset(&t, 0, sizeof(t));
+    memset(tables, 0, sizeof(tables));
+    memset(&names, 0, sizeof(names));
+
+    if ((fd = open(dbpath, O_RDONLY)) < 0)
+        return (-1);
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || sb.st_size == 0)
+        goto cleanup;
+    db = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (db == MAP_FAILED)
+        goto cleanup;
+    madvise(db, sb.st_size, MADV_SEQUENTIAL);
+
+    if (bigram_iter_init(&it, db, sb.st_size) != 0 || table_grow(&t) != 0)
+        goto cleanup;
+
+    for (;;) {
+        if (nentries % INDEX_ANCHOR == 0 && it.p < it.end) {
+            /* save the decoder state, the anchor will start here */
+            if (nanchors == anchors_cap) {
+                anchors_cap = anchors_cap ? anchors_cap * 2 : 1024;
+                nb = realloc(anchors, anchors_cap * sizeof(struct block));
+                if (nb == NULL)
+                    goto cleanup;
+                anchors = nb;
+            }
+            if (strings_cap - strings_size < it.len) {
+                strings_cap = strings_cap * 2 + MAXPATHLEN;
+                if ((ns = realloc(strings, strings_cap)) == NULL)
+                    goto cleanup;
+                strings = ns;
+            }
+            anchors[nanchors].off = it.p - it.base;
+            anchors[nanchors].count = it.count;
+            anchors[nanchors].len = it.len;
+            anchors[nanchors].path = strings_size;
+            memcpy(strings + strings_size, it.path, it.len);
+            strings_size += it.len;
+            nanchors++;
+        }
+        if (nentries % INDEX_BLOCK == 0 && it.p < it.end) {
+            /* blocks start on an anchor */
+            if (nblocks == blocks_cap) {
+                blocks_cap = blocks_cap ? blocks_cap * 2 : 1024;
+                nb = realloc(blocks, blocks_cap * sizeof(struct block));
+                if (nb == NULL)
+                    goto cleanup;
+                blocks = nb;
+            }
+            blocks[nblocks++] = anchors[nanchors - 1];
+        }
+
+        prev_off = it.p - it.base;
+        prev_count = it.count;
+        if ((r = bigram_iter_next(&it)) <= 0) {
+            if (r < 0)
+                goto cleanup;
+            break;
+        }
+
+        sep = strchr((char *)it.path, '*');
+        name_len = sep ? (size_t)(sep - (char *)it.path) : it.len;
+        if (pkg == NULL || pkg->name_len != name_len ||
+            memcmp(strings + pkg->name, it.path, name_len) != 0) {
+            /* first entry of a run of another package */
+            if (pkg != NULL)
+                pkg->end = prev_off;
+            if (npackages == packages_cap) {
+                packages_cap = packages_cap ? packages_cap * 2 : 1024;
+                np = realloc(packages, packages_cap * sizeof(struct package));
+                if (np == NULL)
+                    goto cleanup;
+                packages = np;
+            }
+            if (strings_cap - strings_size < name_len + MAXPATHLEN) {
+                strings_cap = strings_cap * 2 + name_len + MAXPATHLEN;
+                if ((ns = realloc(strings, strings_cap)) == NULL)
+                    goto cleanup;
+                strings = ns;
+            }
+            pkg = &packages[npackages++];
+            pkg->name = strings_size;
+            pkg->name_len = name_len;
+            pkg->nentries = 0;
+            memcpy(strings + strings_size, it.path, name_len);
+            strings_size += name_len;
+            /*
+             * The decoder only reads the first it.count bytes of the
+             * previous path, they are still in it.path. It is saved up
+             * to the previous count too, bigram_iter_seek() wants it.
+             */
+            pkg->start.off = prev_off;
+            pkg->start.count = prev_count;
+            pkg->start.len = MAX(prev_count, it.count);
+            pkg->start.path = strings_size;
+            memcpy(strings + strings_size, it.path, pkg->start.len);
+            strings_size += pkg->start.len;
+        }
+        pkg->nentries++;
+
+        /*
+         * Only the path is matched by a search. The trigrams lying in
+         * the prefix shared with the previous entry have already been
+         * added, unless this entry starts a new block.
+         */
+        start = sep ? (size_t)(sep - (char *)it.path) + 1 : 0;
+        if (nentries % INDEX_BLOCK != 0 && it.count >= 2 &&
+            (size_t)it.count - 2 > start)
+            start = it.count - 2;
+        for (i = start; i + 2 < it.len; i++) {
+            if (table_add(&t, TRIGRAM(it.path + i), nblocks - 1) != 0)
+                goto cleanup;
+        }
+        entry_keys((char *)it.path, &path, &path_len, &base, &base_len);
+        if (names_add(&names, base, base_len) != 0)
+            goto cleanup;
+        nentries++;
+    }
+    if (pkg != NULL)
+        pkg->end = it.p - it.base;
+
+
+    for (hash_bits = 0; hash_bits < 31 &&
+        ((uint64_t)HASH_LOAD << hash_bits) < nentries; hash_bits++)
+        ;
+    if (hash_build(&it, 1U << hash_bits, tables) != 0 ||
+        names_write(&names, &namesdata, &names_size) != 0)
+        goto cleanup;
+
+    if (snprintf(tmppath, sizeof(tmppath), "%s.XXXXXX", idxpath) >=
+        (int)sizeof(tmppath))
+        goto cleanup;
+    if ((tmpfd = mkstemp(tmppath)) < 0)
+        goto cleanup;
+    tmpcreated = 1;
+    if ((fp = fdopen(tmpfd, "w")) == NULL)
+        goto cleanup;
+    if (index_write(fp, &sb, nentries, blocks, nblocks, &t, packages,
+        npackages, anchors, nanchors, tables, hash_bits, namesdata,
+        names_size, names.nnames, strings, strings_size) != 0)
+        goto cleanup;
+    fchmod(tmpfd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fflush(fp) != 0 || fsync(tmpfd) != 0)
+        goto cleanup;
+    r = fclose(fp);
+    fp = NULL;
+    tmpfd = -1;
+    if (r != 0)
+        goto cleanup;
+    if (rename(tmppath, idxpath) != 0)
+        goto cleanup;
+    ret = 0;
+
+cleanup:
+    if (fp != NULL)
+        fclose(fp);
+    else if (tmpfd >= 0)
+        close(tmpfd);
+    if (ret != 0 && tmpcreated)
+        unlink(tmppath);
+    if (t.slots != NULL)
+        table_free(&t);
+    free(blocks);
+    free(packages);
+    free(anchors);
+    free(tables[0].dir);
+    free(tables[0].entries);
+    free(tables[1].dir);
+    free(tables[1].entries);
+    names_free(&names);
+    free(namesdata);
+    free(strings);
+    if (db != MAP_FAILED)
+        munmap(db, sb.st_size);
+    close(fd);
+
+    return (ret);
+}
+
+/*
+ * Map the index at path. Returns -1 if it doesn't exist, is damaged or
+ * has been built for another database than the one open on dbfd.
+ */
+int
+index_open(struct provides_index *idx, const char *path, int dbfd)
+{
+    struct stat sb, dbsb;
+    const u_char *h;
+    static const int hdr_off[] = { 64, 72, 80, 88, 112, 120, 128, 144, 96 };
+    uint64_t off[10], nbuckets;
+    int fd, i;
+
+    memset(idx, 0, sizeof(*idx));
+
+    if (fstat(dbfd, &dbsb) != 0)
+        return (-1);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return (-1);
+    if (fstat(fd, &sb) != 0 || sb.st_size < HDR_SIZE) {
+        close(fd);
+        return (-1);
+    }
+    idx->map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (idx->map == MAP_FAILED) {
+        idx->map = NULL;
+        return (-1);
+    }
+    idx->size = sb.st_size;
+
+    h = idx->map;
+    if (memcmp(h, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+        get_le32(h + 8) != INDEX_VERSION ||
+        get_le32(h + 12) != INDEX_BLOCK ||
+        get_le64(h + 16) != (uint64_t)dbsb.st_size ||
+        get_le64(h + 24) != (uint64_t)dbsb.st_mtim.tv_sec ||
+        get_le64(h + 32) != (uint64_t)dbsb.st_mtim.tv_nsec ||
+        get_le64(h + 40) != (uint64_t)dbsb.st_ino)
+        goto stale;
+
+    idx->nentries = get_le64(h + 48);
+    idx->nblocks = get_le32(h + 56);
+    idx->ntrigrams = get_le32(h + 60);
+    idx->npackages = get_le32(h + 104);
+    idx->hash_bits = get_le32(h + 108);
+    idx->nanchors = get_le32(h + 136);
+    idx->nnames = get_le32(h + 140);
+    idx->nnamegroups = howmany(idx->nnames, NAME_GROUP);
+    for (i = 0; i < 9; i++)
+        off[i] = get_le64(h + hdr_off[i]);
+    off[9] = idx->size;
+    nbuckets = (uint64_t)1 << MIN(idx->hash_bits, 31);
+
+    if (idx->hash_bits > 31 || off[0] != HDR_SIZE ||
+        off[1] - off[0] != (uint64_t)idx->nblocks * BLOCK_SIZE ||
+        off[2] - off[1] != (uint64_t)idx->ntrigrams * TRIGRAM_SIZE ||
+        off[3] < off[2] ||
+        off[4] - off[3] != (uint64_t)idx->npackages * PACKAGE_SIZE ||
+        off[5] - off[4] != (uint64_t)idx->nanchors * BLOCK_SIZE ||
+        off[6] < off[5] || off[6] - off[5] < (nbuckets + 1) * 4 ||
+        off[7] < off[6] || off[7] - off[6] < (nbuckets + 1) * 4 ||
+        off[8] < off[7] ||
+        off[8] - off[7] < (uint64_t)idx->nnamegroups * 4 ||
+        off[9] < off[8])
+        goto stale;
+
+    idx->blocks = h + off[0];
+    idx->trigrams = h + off[1];
+    idx->postings = h + off[2];
+    idx->postings_size = off[3] - off[2];
+    idx->packages = h + off[3];
+    idx->anchors = h + off[4];
+    idx->paths = h + off[5];
+    idx->paths_size = off[6] - off[5];
+    idx->basenames = h + off[6];
+    idx->basenames_size = off[7] - off[6];
+    idx->names = h + off[7];
+    idx->names_size = off[8] - off[7];
+    idx->strings = h + off[8];
+    idx->strings_size = off[9] - off[8];
+
+    return (0);
+
+stale:
+    index_close(idx);
+    return (-1);
+}
+
+void
+index_close(struct provides_index *idx)
+{
+    if (idx->map != NULL)
+        munmap(idx->map, idx->size);
+    memset(idx, 0, sizeof(*idx));
+}
+
+/*
+ * Clear the blocks of cand not containing trigram.
+ * Returns -1 if the posting list is damaged.
+ */
+static int
+index_filter(struct provides_index *idx, uint32_t trigram, u_char *cand,
+    u_char *tmp)
+{
+    const u_char *rec, *p, *end;
+    uint32_t lo, hi, mid, n, v, block;
+
+    lo = 0;
+    hi = idx->ntrigrams;
+    rec = NULL;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        v = get_le32(idx->trigrams + (size_t)mid * TRIGRAM_SIZE);
+        if (v == trigram) {
+            rec = idx->trigrams + (size_t)mid * TRIGRAM_SIZE;
+            break;
+        }
+        if (v < trigram)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (rec == NULL) {
+        /* no block holds this trigram */
+        memset(cand, 0, idx->nblocks);
+        return (0);
+    }
+
+    n = get_le32(rec + 4);
+    if (get_le64(rec + 8) > idx->postings_size)
+        return (-1);
+    p = idx->postings + get_le64(rec + 8);
+    end = idx->postings + idx->postings_size;
+
+    memset(tmp, 0, idx->nblocks);
+    for (block = 0; n > 0; n--) {
+        if ((p = get_varint(p, end, &v)) == NULL)
+            return (-1);
+        block += v;
+        if (block >= idx->nblocks)
+            return (-1);
+        tmp[block] = 1;
+    }
+    for (block = 0; block < idx->nblocks; block++)
+        cand[block] &= tmp[block];
+
+    return (0);
+}
+
+/*
+ * Clear in cand the blocks which can't hold entries matching pat.
+ * Returns the number of trigrams used, 0 meaning that every block is
+ * a candidate, or -1 if the index is damaged.
+ */
+int
+index_candidates(struct provides_index *idx, const struct pattern *pat,
+    u_char *cand)
+{
+    u_char *tmp;
+    size_t j;
+    int ntrigrams = 0, l;
+
+    if ((tmp = malloc(idx->nblocks)) == NULL)
+        return (-1);
+
+    for (l = 0; l < pat->nliterals; l++) {
+        for (j = 0; j + 2 < pat->lens[l]; j++) {
+            if (index_filter(idx, TRIGRAM((u_char *)pat->literals[l] + j),
+                cand, tmp) != 0) {
+                free(tmp);
+                return (-1);
+            }
+            ntrigrams++;
+        }
+    }
+    free(tmp);
+
+    return (ntrigrams);
+}
+
+static int
+block_seek(struct provides_index *idx, const u_char *blocks, uint32_t n,
+    uint32_t i, struct bigram_iter *it)
+{
+    const u_char *rec;
+    uint64_t off, end, path;
+    uint32_t count, len;
+
+    if (i >= n)
+        return (-1);
+
+    rec = blocks + (size_t)i * BLOCK_SIZE;
+    off = get_le64(rec);
+    count = get_le32(rec + 8);
+    len = get_le32(rec + 12);
+    path = get_le64(rec + 16);
+    end = (i + 1 < n) ? get_le64(rec + BLOCK_SIZE) : it->size;
+
+    if (path > idx->strings_size || len > idx->strings_size - path)
+        return (-1);
+
+    return (bigram_iter_seek(it, off, end, count,
+        (const char *)idx->strings + path, len));
+}
+
+/*
+ * Position the iterator, initialized on the indexed database, on the
+ * entries of block i. Returns -1 if the index is damaged.
+ */
+int
+index_block(struct provides_index *idx, uint32_t i, struct bigram_iter *it)
+{
+    return (block_seek(idx, idx->blocks, idx->nblocks, i, it));
+}
+
+/*
+ * Position the iterator, initialized on the indexed database, on the
+ * anchor i. Returns -1 if the index is damaged.
+ */
+int
+index_anchor(struct provides_index *idx, uint32_t i, struct bigram_iter *it)
+{
+    return (block_seek(idx, idx->anchors, idx->nanchors, i, it));
+}
+
+/*
+ * Find the runs of entries of package name in the package table.
+ * Returns the number of runs, the first one being stored in first.
+ */
+uint32_t
+index_package(struct provides_index *idx, const char *name, uint32_t *first)
+{
+    const u_char *rec;
+    uint64_t off;
+    uint32_t lo, hi, mid, len, n;
+    size_t name_len = strlen(name);
+    int r;
+
+    lo = 0;
+    hi = idx->npackages;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        rec = idx->packages + (size_t)mid * PACKAGE_SIZE;
+        off = get_le64(rec);
+        len = get_le32(rec + 8);
+        if (off > idx->strings_size || len > idx->strings_size - off)
+            return (0);
+        r = memcmp(idx->strings + off, name, MIN(len, name_len));
+        if (r < 0 || (r == 0 && len < name_len))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *first = lo;
+    for (n = 0; lo + n < idx->npackages; n++) {
+        rec = idx->packages + (size_t)(lo + n) * PACKAGE_SIZE;
+        off = get_le64(rec);
+        len = get_le32(rec + 8);
+        if (len != name_len || off > idx->strings_size ||
+            len > idx->strings_size - off ||
+            memcmp(idx->strings + off, name, len) != 0)
+            break;
+    }
+
+    return (n);
+}
+
+/*
+ * Position the iterator, initialized on the indexed database, on the
+ * run of package entries i. Returns -1 if the index is damaged.
+ */
+int
+index_package_run(struct provides_index *idx, uint32_t i,
+    struct bigram_iter *it)
+{
+    const u_char *rec;
+    uint64_t path;
+    uint32_t len;
+
+    if (i >= idx->npackages)
+        return (-1);
+
+    rec = idx->packages + (size_t)i * PACKAGE_SIZE;
+    len = get_le32(rec + 36);
+    path = get_le64(rec + 40);
+    if (path > idx->strings_size || len > idx->strings_size - path)
+        return (-1);
+
+    return (bigram_iter_seek(it, get_le64(rec + 16), get_le64(rec + 24),
+        get_le32(rec + 32), (const char *)idx->strings + path, len));
+}
+
+/*
+ * Find the anchors followed by an entry whose path, or basename when
+ * basename is set, may be key. Their numbers are stored in ascending
+ * order in a buffer allocated in anchors. Returns how many there are,
+ * or -1 if the index is damaged.
+ */
+int
+index_lookup(struct provides_index *idx, const char *key, bool basename,
+    uint32_t **anchors)
+{
+    const u_char *table, *e;
+    size_t size, nbuckets;
+    uint64_t h;
+    uint32_t fp, first, last, anchor, *a;
+    int n;
+
+    *anchors = NULL;
+    if (basename) {
+        table = idx->basenames;
+        size = idx->basenames_size;
+    } else {
+        table = idx->paths;
+        size = idx->paths_size;
+    }
+
+    nbuckets = (size_t)1 << idx->hash_bits;
+    h = hash_key(key, strlen(key));
+    first = get_le32(table + (h & (nbuckets - 1)) * 4);
+    last = get_le32(table + ((h & (nbuckets - 1)) + 1) * 4);
+    if (first > last ||
+        last > (size - (nbuckets + 1) * 4) / HASH_ENTRY_SIZE)
+        return (-1);
+
+    if ((a = malloc((last - first + 1) * sizeof(uint32_t))) == NULL)
+        exit(ENOMEM);
+
+    /* the entries of a bucket are sorted by fingerprint then anchor */
+    fp = h >> 32;
+    e = table + (nbuckets + 1) * 4;
+    for (n = 0; first < last; first++) {
+        if (get_le32(e + (size_t)first * HASH_ENTRY_SIZE) != fp)
+            continue;
+        anchor = get_le32(e + (size_t)first * HASH_ENTRY_SIZE + 4);
+        if (anchor >= idx->nanchors) {
+            free(a);
+            return (-1);
+        }
+        a[n++] = anchor;
+    }
+    *anchors = a;
+
+    return (n);
+}
+
+/* Parse the name at p, up to the count of its anchors */
+static const u_char *
+name_next(const u_char *p, const u_char *end, size_t *len, uint32_t *n)
+{
+    const u_char *nul;
+
+    if ((nul = memchr(p, '\0', end - p)) == NULL)
+        return (NULL);
+    *len = nul - p;
+
+    return (get_varint(nul + 1, end, n));
+}
+
+static int
+name_group(struct provides_index *idx, uint32_t i, const u_char **p,
+    const u_char **end)
+{
+    const u_char *names;
+    uint64_t off, last, size;
+
+    if (i >= idx->nnamegroups)
+        return (-1);
+
+    names = idx->names + (size_t)idx->nnamegroups * 4;
+    size = idx->names_size - (size_t)idx->nnamegroups * 4;
+    off = get_le32(idx->names + (size_t)i * 4);
+    last = (i + 1 < idx->nnamegroups) ?
+        get_le32(idx->names + (size_t)(i + 1) * 4) : size;
+    if (off > last || last > size)
+        return (-1);
+    *p = names + off;
+    *end = names + last;
+
+    return (0);
+}
+
+/*
+ * Match the names of group i with match, setting hits[n] for each name
+ * n it accepts. Returns -1 if the index is damaged.
+ */
+int
+index_names(struct provides_index *idx, uint32_t i,
+    bool (*match)(const char *, size_t, void *), void *arg, u_char *hits)
+{
+    const u_char *p, *end, *name;
+    uint32_t n, last, k, v;
+    size_t len;
+
+    if (name_group(idx, i, &p, &end) != 0)
+        return (-1);
+
+    last = MIN((uint64_t)(i + 1) * NAME_GROUP, idx->nnames);
+    for (n = i * NAME_GROUP; n < last; n++) {
+        name = p;
+        if ((p = name_next(p, end, &len, &k)) == NULL)
+            return (-1);
+        hits[n] = match((const char *)name, len, arg);
+        for (; k > 0; k--) {
+            if ((p = get_varint(p, end, &v)) == NULL)
+                return (-1);
+        }
+    }
+
+    return (0);
+}
+
+/*
+ * Set in anchors the anchors followed by an entry having one of the
+ * names set in hits. Returns -1 if the index is damaged.
+ */
+int
+index_name_anchors(struct provides_index *idx, const u_char *hits,
+    u_char *anchors)
+{
+    const u_char *p, *end;
+    uint32_t i, n, first, last, j, k, v, a;
+    size_t len;
+
+    for (i = 0; i < idx->nnamegroups; i++) {
+        first = i * NAME_GROUP;
+        last = MIN((uint64_t)first + NAME_GROUP, idx->nnames);
+        for (n = first; n < last && !hits[n]; n++)
+            ;
+        if (n == last)
+            continue;
+
+        if (name_group(idx, i, &p, &end) != 0)
+            return (-1);
+        for (n = first; n < last; n++) {
+            if ((p = name_next(p, end, &len, &k)) == NULL)
+                return (-1);
+            for (j = 0, a = 0; j < k; j++) {
+                if ((p = get_varint(p, end, &v)) == NULL)
+                    return (-1);
+                a = j ? a + v : v;
+                if (a >= idx->nanchors)
+                    return (-1);
+                if (hits[n])
+                    anchors[a] = 1;
+            }
+        }
+    }
+
+    return (0);
+}
@@ -0,0 +1,456 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Extraction of the literal substrings a PCRE pattern requires.
+ *
+ * The analysis is conservative: everything it is not sure about
+ * (groups, classes, escapes, optional atoms) just ends the current
+ * literal, so every string it returns appears in any subject the
+ * pattern matches. Patterns using alternation at the top level or
+ * inline options yield no literal at all.
+ *
+ * pattern_prefilter() uses them to reject most of the database entries
+ * with a caseless substring search before the regex engine runs.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "provides.h"
+
+struct parser {
+    struct pattern *pat;
+    char *run;                      /* literal being collected */
+    size_t len;
+    int last_char;                  /* last atom was appended to run */
+    int anchored;                   /* run starts after a leading ^ */
+};
+
+static int
+add_literal(struct pattern *pat, const char *s, size_t len)
+{
+    char *lit;
+
+    if (pat->nliterals >= PATTERN_MAX_LITERALS)
+        return (0);
+
+    if ((lit = malloc(len + 1)) == NULL)
+        return (-1);
+    memcpy(lit, s, len);
+    lit[len] = '\0';
+
+    pat->literals[pat->nliterals] = lit;
+    pat->lens[pat->nliterals] = len;
+    pat->nliterals++;
+
+    return (0);
+}
+
+static int
+end_run(struct parser *ps)
+{
+    struct pattern *pat = ps->pat;
+    int n = pat->nliterals, ret = 0;
+
+    if (ps->len > 0)
+        ret = add_literal(pat, ps->run, ps->len);
+    if (ps->anchored && pat->nliterals > n) {
+        pat->prefix = pat->literals[n];
+        pat->prefix_len = pat->lens[n];
+    }
+    ps->len = 0;
+    ps->last_char = 0;
+    ps->anchored = 0;
+
+    return (ret);
+}
+
+static void
+append(struct parser *ps, int c)
+{
+    ps->run[ps->len++] = LOWER(c);
+    ps->last_char = 1;
+}
+
+/*
+ * Skip a character class starting at s (pointing to the opening
+ * bracket). Returns a pointer past the closing bracket or NULL.
+ */
+static const char *
+skip_class(const char *s)
+{
+    s++;
+    if (*s == '^')
+        s++;
+    if (*s == ']')
+        s++;
+
+    for (; *s != '\0'; s++) {
+        if (*s == '\\') {
+            if (*++s == '\0')
+                return (NULL);
+        } else if (s[0] == '[' && s[1] == ':') {
+            const char *e = strstr(s + 2, ":]");
+            if (e != NULL)
+                s = e + 1;
+        } else if (*s == ']') {
+            return (s + 1);
+        }
+    }
+
+    return (NULL);
+}
+
+/*
+ * Skip a group starting at s (pointing to the opening parenthesis).
+ * Returns a pointer past the closing parenthesis or NULL if it is
+ * unbalanced.
+ */
+static const char *
+skip_group(const char *s)
+{
+    int depth = 0;
+
+    for (; *s != '\0'; s++) {
+        if (*s == '\\') {
+            if (*++s == '\0')
+                return (NULL);
+        } else if (*s == '[') {
+            if ((s = skip_class(s)) == NULL)
+                return (NULL);
+            s--;
+        } else if (*s == '(') {
+            depth++;
+        } else if (*s == ')') {
+            if (--depth == 0)
+                return (s + 1);
+        }
+    }
+
+    return (NULL);
+}
+
+/*
+ * Parse a {n,m} quantifier. Returns a pointer past it and stores the
+ * minimum in *min, or NULL if the brace is a literal one.
+ */
+static const char *
+parse_braces(const char *s, long *min)
+{
+    const char *p = s + 1;
+    int digits = 0;
+
+    *min = 0;
+    while (*p == ' ')
+        p++;
+    for (; isdigit((unsigned char)*p); p++, digits++)
+        *min = *min * 10 + (*p - '0');
+    while (*p == ' ')
+        p++;
+    if (*p == ',') {
+        p++;
+        while (*p == ' ' || isdigit((unsigned char)*p)) {
+            digits++;
+            p++;
+        }
+    }
+    if (*p != '}' || digits == 0)
+        return (NULL);
+
+    return (p + 1);
+}
+
+/*
+ * Skip the argument of an escape sequence like \x{..}, \p{..}, \k<..>,
+ * \g'..', \cX or \0dd so its characters are not taken as literals.
+ */
+static const char *
+skip_escape(const char *s, int c)
+{
+    const char *e;
+
+    if (strchr("xopPNgk", c) != NULL &&
+        (*s == '{' || *s == '<' || *s == '\'')) {
+        e = strchr(s + 1, *s == '{' ? '}' : *s == '<' ? '>' : '\'');
+        return (e != NULL ? e + 1 : s + strlen(s));
+    }
+
+    switch (c) {
+    case 'c':
+        return (*s != '\0' ? s + 1 : s);
+    case 'x':
+        for (c = 0; c < 2 && isxdigit((unsigned char)*s); c++)
+            s++;
+        return (s);
+    case 'g':
+        if (*s == '-' || *s == '+')
+            s++;
+        /* FALLTHROUGH */
+    default:
+        if (isdigit(c) || c == 'g' || c == 'o')
+            while (isdigit((unsigned char)*s))
+                s++;
+        return (s);
+    }
+}
+
+static int
+literal_cmp(const void *a, const void *b)
+{
+    size_t la = strlen(*(char * const *)a), lb = strlen(*(char * const *)b);
+
+    return (la > lb ? -1 : la < lb);
+}
+
+/*
+ * Return true if the group at s sets options, calls a subroutine or
+ * is anything whose effect on the rest of the pattern we can't tell.
+ */
+static int
+opaque_group(const char *s)
+{
+    if (s[1] == '*')
+        return (1);
+    if (s[1] != '?')
+        return (0);
+
+    return (strchr(":=!<>|'P", s[2]) == NULL || s[2] == '\0');
+}
+
+int
+pattern_analyse(struct pattern *pat, const char *regex)
+{
+    struct parser ps;
+    const char *s, *e;
+    long min;
+    int c, n, last_char;
+
+    memset(pat, 0, sizeof(*pat));
+
+    if ((ps.run = malloc(strlen(regex) + 1)) == NULL)
+        return (-1);
+    ps.pat = pat;
+    ps.len = 0;
+    ps.last_char = 0;
+    ps.anchored = 0;
+
+    for (s = regex; *s != '\0';) {
+        c = (unsigned char)*s++;
+        switch (c) {
+        case '\\':
+            c = (unsigned char)*s++;
+            if (c == '\0')
+                goto nolit;
+            if (c == 'Q') {
+                e = strstr(s, "\\E");
+                if (e == NULL)
+                    e = s + strlen(s);
+                for (; s < e; s++)
+                    append(&ps, *s);
+                if (*s != '\0')
+                    s += 2;
+            } else if (c == 'E') {
+                /* stray \E is ignored */
+            } else if (isalnum(c)) {
+                if (end_run(&ps) != 0)
+                    goto fail;
+                s = skip_escape(s, c);
+            } else {
+                append(&ps, c);
+            }
+            break;
+        case '(':
+            if (opaque_group(s - 1))
+                goto nolit;
+            if (end_run(&ps) != 0)
+                goto fail;
+            if ((s = skip_group(s - 1)) == NULL)
+                goto nolit;
+            break;
+        case '[':
+            if (end_run(&ps) != 0)
+                goto fail;
+            if ((s = skip_class(s - 1)) == NULL)
+                goto nolit;
+            break;
+        case '|':
+        case ')':
+            goto nolit;
+        case '?':
+        case '*':
+        case '{':
+            min = 0;
+            if (c == '{' && (e = parse_braces(s - 1, &min)) == NULL) {
+                /* literal brace, just don't keep it */
+                if (end_run(&ps) != 0)
+                    goto fail;
+                break;
+            }
+            if (c == '{')
+                s = e;
+            /* the previous atom is optional */
+            if (min == 0 && ps.last_char)
+                ps.len--;
+            /* FALLTHROUGH */
+        case '+':
+            if (end_run(&ps) != 0)
+                goto fail;
+            /* lazy or possessive quantifier */
+            if (*s == '?' || *s == '+')
+                s++;
+            break;
+        case '$':
+            n = pat->nliterals;
+            last_char = ps.last_char;
+            if (end_run(&ps) != 0)
+                goto fail;
+            /* the literal right before a final $ ends the subject */
+            if (*s == '\0' && last_char && pat->nliterals > n) {
+                pat->suffix = pat->literals[n];
+                pat->suffix_len = pat->lens[n];
+            }
+            break;
+        case '^':
+            if (end_run(&ps) != 0)
+                goto fail;
+            if (s - 1 == regex)
+                ps.anchored = 1;
+            break;
+        case '.':
+            if (end_run(&ps) != 0)
+                goto fail;
+            break;
+        default:
+            append(&ps, c);
+            break;
+        }
+    }
+
+    if (end_run(&ps) != 0)
+        goto fail;
+    free(ps.run);
+
+    /* the longest literals usually reject the most */
+    qsort(pat->literals, pat->nliterals, sizeof(char *), literal_cmp);
+    for (n = 0; n < pat->nliterals; n++)
+        pat->lens[n] = strlen(pat->literals[n]);
+
+    return (0);
+
+nolit:
+    /* nothing is mandatory, the literals collected so far are useless */
+    pattern_free(pat);
+    free(ps.run);
+    return (0);
+
+fail:
+    pattern_free(pat);
+    free(ps.run);
+    return (-1);
+}
+
+void
+pattern_free(struct pattern *pat)
+{
+    int i;
+
+    for (i = 0; i < pat->nliterals; i++)
+        free(pat->literals[i]);
+    memset(pat, 0, sizeof(*pat));
+}
+
+static int
+ci_equal(const char *s, const char *lit, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (LOWER((u_char)s[i]) != (u_char)lit[i])
+            return (0);
+    }
+
+    return (1);
+}
+
+static const char *
+ci_memmem(const char *s, size_t len, const char *lit, size_t n)
+{
+    const char *end;
+    int c, uc;
+
+    if (n > len)
+        return (NULL);
+
+    end = s + len - n;
+    c = (u_char)lit[0];
+    uc = (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+    if (c == uc) {
+        while (s <= end && (s = memchr(s, c, end - s + 1)) != NULL) {
+            if (ci_equal(s + 1, lit + 1, n - 1))
+                return (s);
+            s++;
+        }
+        return (NULL);
+    }
+
+    for (; s <= end; s++) {
+        if (((u_char)*s == c || (u_char)*s == uc) &&
+            ci_equal(s + 1, lit + 1, n - 1))
+            return (s);
+    }
+
+    return (NULL);
+}
+
+/*
+ * Cheap check run before the regex engine. Returns 0 if the subject
+ * can't match the pattern the literals were extracted from, 1 if it
+ * may.
+ */
+int
+pattern_prefilter(const struct pattern *pat, const char *s, size_t len)
+{
+    int i;
+
+    if (pat->prefix != NULL && (len < pat->prefix_len ||
+        !ci_equal(s, pat->prefix, pat->prefix_len)))
+        return (0);
+
+    if (pat->suffix != NULL && (len < pat->suffix_len ||
+        !ci_equal(s + len - pat->suffix_len, pat->suffix, pat->suffix_len)))
+        return (0);
+
+    for (i = 0; i < pat->nliterals; i++) {
+        if (pat->literals[i] == pat->prefix || pat->literals[i] == pat->suffix)
+            continue;
+        if (ci_memmem(s, len, pat->literals[i], pat->lens[i]) == NULL)
+            return (0);
+    }
+
+    return (1);
+}
@@ -30,15 +30,92 @@ PKGPATH=$2
 
 . ${SCRIPTPREFIX}/common.sh
 
-mkdir ${POUDRIERE_DATA}/cache/${MASTERNAME}/provides_db
+DBDIR=${POUDRIERE_DATA}/cache/${MASTERNAME}/provides_db
+# number of previous databases a delta is published for
+DELTAS_KEEP=${PROVIDES_DELTAS_KEEP:-7}
+# megabytes of file lists the generator holds in memory before sorting
+# them to disk
+GEN_MEMORY=${PROVIDES_GEN_MEMORY:-1024}
+
+mkdir -p ${DBDIR}
 
 msg "pkg-provides: start building the database using ${PARALLEL_JOBS} threads"
 
-msg "pkg-provides: extracting file list form packages"
-/usr/local/etc/poudriere.d/hooks/provides-db-gen.rb ${PKGPATH}/All ${PARALLEL_JOBS} > ${POUDRIERE_DATA}/cache/${MASTERNAME}/provides_db/provides.data
+msg "pkg-provides: extracting file lists from packages"
+# Only the packages changed since the last run are read, the file lists
+# of the others are kept in ${DBDIR}/files. The database is compressed
+# while it is encoded, xz -T0 writes a multi-block stream the client
+# decodes in parallel. The v4 database is written in the same passes.
+# The shell only reports the status of the last command of a pipeline,
+# each one leaves a file behind when it succeeds.
+rm -f ${DBDIR}/gen.ok ${DBDIR}/tee.ok ${DBDIR}/xz.ok
+{
+	/usr/local/etc/poudriere.d/hooks/provides-db-gen -j ${PARALLEL_JOBS:-0} \
+	    -c ${DBDIR}/files -m ${GEN_MEMORY} -T ${DBDIR} \
+	    -4 ${DBDIR}/provides.v4.db ${PKGPATH}/All - &&
+	    touch ${DBDIR}/gen.ok
+} | {
+	tee ${DBDIR}/provides.db && touch ${DBDIR}/tee.ok
+} | {
+	xz -T0 > ${DBDIR}/provides.db.xz && touch ${DBDIR}/xz.ok
+}
+for step in gen tee xz; do
+	[ -f ${DBDIR}/${step}.ok ] || exit 1
+done
+
+msg "pkg-provides: packaging the database"
+mv ${DBDIR}/provides.db.xz ${PKGPATH}/provides.db.xz || exit 1
+# the zstd variant is preferred by the clients that support it, it is
+# written aside and renamed so they never fetch a partial file
+zstd -q -f -19 -T0 ${DBDIR}/provides.db -o ${PKGPATH}/provides.db.zst.tmp ||
+    exit 1
+mv ${PKGPATH}/provides.db.zst.tmp ${PKGPATH}/provides.db.zst || exit 1
+# the v4 database, fetched first by the clients that support it
+mkdir -p ${PKGPATH}/v4
+xz -T0 -c ${DBDIR}/provides.v4.db > ${PKGPATH}/v4/provides.db.xz.tmp || exit 1
+mv ${PKGPATH}/v4/provides.db.xz.tmp ${PKGPATH}/v4/provides.db.xz || exit 1
+zstd -q -f -19 -T0 ${DBDIR}/provides.v4.db -o ${PKGPATH}/v4/provides.db.zst.tmp ||
+    exit 1
+mv ${PKGPATH}/v4/provides.db.zst.tmp ${PKGPATH}/v4/provides.db.zst || exit 1
+
+# Deltas from the previous databases kept in $2 to the database $1,
+# published in $3 and named after the sha256 of the database they apply
+# to: clients holding one of them fetch the delta. The sha256 of $1 is
+# published last in $4, the clients check the database they rebuild
+# against it.
+publish_deltas() {
+	local db=$1 history=$2 dir=$3 digest=$4 old base delta sum
+
+	sum=$(sha256 -q ${db}) || exit 1
+	mkdir -p ${history} ${dir}
+	for old in $(ls -t ${history}/*.db 2>/dev/null | head -n ${DELTAS_KEEP}); do
+		base=$(basename ${old} .db)
+		[ ${base} = ${sum} ] && continue
+		zstd -q -f -19 --long=31 --patch-from=${old} ${db} \
+		    -o ${dir}/${base}.zst.tmp || exit 1
+		mv ${dir}/${base}.zst.tmp ${dir}/${base}.zst || exit 1
+	done
+
+	mv ${db} ${history}/${sum}.db || exit 1
+	ls -t ${history}/*.db | tail -n +$((DELTAS_KEEP + 2)) | xargs rm -f
+	# the deltas of the databases gone from the history, and the one
+	# from the new database if it was published before, are stale
+	for delta in ${dir}/*.zst; do
+		[ -f ${delta} ] || continue
+		base=$(basename ${delta} .zst)
+		if [ ! -f ${history}/${base}.db -o ${base} = ${sum} ]; then
+			rm -f ${delta}
+		fi
+	done
+
+	echo ${sum} > ${digest}.tmp && mv ${digest}.tmp ${digest} || exit 1
+}
 
-msg "pkg-provides: sorting and packaging the database"
-sort ${POUDRIERE_DATA}/cache/${MASTERNAME}/provides_db/provides.data | /usr/libexec/locate.mklocatedb | xz > ${PKGPATH}/provides.db.xz
+msg "pkg-provides: generating deltas from the last ${DELTAS_KEEP} databases"
+publish_deltas ${DBDIR}/provides.db ${DBDIR}/history ${PKGPATH}/deltas \
+    ${PKGPATH}/provides.db.sha256
+publish_deltas ${DBDIR}/provides.v4.db ${DBDIR}/history.v4 ${PKGPATH}/v4/deltas \
+    ${PKGPATH}/v4/provides.db.sha256
 
 msg "pkg-provides: database generation complete"
 exit 0
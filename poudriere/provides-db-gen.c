@@ -0,0 +1,1179 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Provides database generator, run by the pkgrepo.sh poudriere hook.
+ *
+ *	provides-db-gen [-j jobs] [-c cachedir] [-m megabytes] [-T tmpdir]
+ *	    [-4 v4file] pkgdir dbfile
+ *
+ * writes to dbfile the locate database of the "pkgname*path" entries of
+ * the packages of pkgdir. The packages are read on jobs threads, all the
+ * online CPUs when it is 0 or not given, each archive being decompressed
+ * only up to its +MANIFEST: pkg create writes the metadata before the
+ * files. Each thread sorts the entries of its packages, the packages are
+ * then put in order and the entries bigram encoded, which replaces the
+ * sort(1) and locate.mklocatedb pipeline.
+ *
+ * The entries held in memory are bounded by -m megabytes (1024 by
+ * default, 0 for no limit): past their share of it, the packages read
+ * are sorted into a run written to tmpdir by the thread that filled it,
+ * while the others go on reading. The runs and the packages left in
+ * memory are then merged straight into the encoder. dbfile can be "-"
+ * to pipe the database to a compressor.
+ *
+ * With -c, the entries of each package are also kept in cachedir, in a
+ * file named after the archive and holding its size and mtime, then
+ * reused while the archive doesn't change: only the packages built since
+ * the last run are read. The files of the packages gone are removed.
+ *
+ * With -4, the v4 database of the same entries is written to v4file in
+ * the same passes: the first one interns the directories, basenames and
+ * package names, numbered once sorted, the second one writes the record
+ * of each file.
+ */
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <ucl.h>
+
+#include "bigram.h"
+#include "db4.h"
+
+#define CACHE_MAGIC "PRVDGEN 1"
+
+struct package {
+    char *file;                     /* archive, relative to pkgdir */
+    off_t size;                     /* of the archive */
+    time_t mtime;
+    char *prefix;                   /* "pkgname*" */
+    char *buf;                      /* entries, NUL terminated */
+    size_t len;
+    size_t cap;
+    char **lines;                   /* sorted entries of buf */
+    size_t nlines;
+};
+
+struct generator {
+    const char *dir;
+    const char *cachedir;           /* NULL without -c */
+    const char *tmpdir;             /* of the runs */
+    size_t runsize;                 /* entries held by a run, 0 for all */
+    struct package *pkgs;
+    size_t npkgs;
+    atomic_size_t next;             /* next package to read */
+    atomic_int skipped;
+    atomic_int cached;              /* packages read from cachedir */
+    pthread_mutex_t lock;           /* of the following */
+    struct package **pending;       /* read, not in a run yet */
+    size_t npending;
+    size_t pendcap;
+    size_t pendsize;
+    FILE **runs;                    /* sorted runs written to tmpdir */
+    size_t nruns;
+};
+
+/* Source of sorted entries merged into the database */
+struct source {
+    FILE *fp;                       /* a run on disk, or */
+    char **lines;                   /* the one in memory */
+    size_t nlines;
+    size_t next;
+    char *line;                     /* current entry, NULL at the end */
+    char *buf;
+    size_t cap;
+};
+
+static int
+strptrcmp(const void *a, const void *b)
+{
+    return (strcmp(*(char * const *)a, *(char * const *)b));
+}
+
+static int
+file_cmp(const void *a, const void *b)
+{
+    return (strcmp(((const struct package *)a)->file,
+        ((const struct package *)b)->file));
+}
+
+static int
+package_cmp(const void *a, const void *b)
+{
+    return (strcmp((*(struct package * const *)a)->prefix,
+        (*(struct package * const *)b)->prefix));
+}
+
+/*
+ * Read the +MANIFEST of the package archive path, stopping at the first
+ * file of the package. Returns NULL if there is none.
+ */
+static char *
+read_manifest(const char *path, size_t *lenp)
+{
+    struct archive *a;
+    struct archive_entry *ae;
+    const char *name;
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    la_ssize_t n;
+    int r;
+
+    if ((a = archive_read_new()) == NULL)
+        errx(1, "archive_read_new");
+    archive_read_support_filter_all(a);
+    archive_read_support_format_tar(a);
+    if (archive_read_open_filename(a, path, 65536) != ARCHIVE_OK) {
+        warnx("%s: %s", path, archive_error_string(a));
+        archive_read_free(a);
+        return (NULL);
+    }
+
+    while ((r = archive_read_next_header(a, &ae)) == ARCHIVE_OK) {
+        name = archive_entry_pathname(ae);
+        if (strcmp(name, "+MANIFEST") == 0)
+            break;
+        if (name[0] != '+') {
+            /* past the metadata */
+            r = ARCHIVE_EOF;
+            break;
+        }
+    }
+    if (r != ARCHIVE_OK) {
+        if (r == ARCHIVE_EOF)
+            warnx("%s: no +MANIFEST", path);
+        else
+            warnx("%s: %s", path, archive_error_string(a));
+        archive_read_free(a);
+        return (NULL);
+    }
+
+    for (;;) {
+        if (cap - len < 65536) {
+            cap = cap ? cap * 2 : 65536;
+            if ((buf = realloc(buf, cap)) == NULL)
+                err(1, "realloc");
+        }
+        if ((n = archive_read_data(a, buf + len, cap - len)) <= 0)
+            break;
+        len += n;
+    }
+    if (n < 0) {
+        warnx("%s: %s", path, archive_error_string(a));
+        free(buf);
+        buf = NULL;
+    }
+    archive_read_free(a);
+    *lenp = len;
+
+    return (buf);
+}
+
+static void
+package_add(struct package *p, const char *name, const char *path,
+    size_t len)
+{
+    size_t n = strlen(name);
+
+    /* what bigram_encode_line() and the v4 format can't write */
+    if (n + 1 + len >= MAXPATHLEN || memchr(path, '\n', len) != NULL ||
+        len == 0 || path[0] != '/') {
+        warnx("%s: skipping %.*s", p->file, (int)len, path);
+        return;
+    }
+    while (p->cap - p->len < n + len + 2) {
+        p->cap = p->cap ? p->cap * 2 : 16384;
+        if ((p->buf = realloc(p->buf, p->cap)) == NULL)
+            err(1, "realloc");
+    }
+    memcpy(p->buf + p->len, name, n);
+    p->buf[p->len + n] = '*';
+    memcpy(p->buf + p->len + n + 1, path, len);
+    p->buf[p->len + n + 1 + len] = '\0';
+    p->len += n + len + 2;
+    p->nlines++;
+}
+
+/* Point the lines of p to the nlines entries of its buffer */
+static void
+package_index(struct package *p)
+{
+    const char *s;
+    size_t i;
+
+    if (p->nlines == 0)
+        return;
+    if ((p->lines = malloc(p->nlines * sizeof(char *))) == NULL)
+        err(1, "malloc");
+    for (i = 0, s = p->buf; i < p->nlines; i++, s += strlen(s) + 1)
+        p->lines[i] = (char *)s;
+}
+
+/* Collect the files listed in manifest, sorted, into p */
+static int
+package_parse(struct package *p, const char *manifest, size_t len)
+{
+    struct ucl_parser *parser;
+    ucl_object_t *obj;
+    const ucl_object_t *name, *files, *cur;
+    ucl_object_iter_t it = NULL;
+    const char *key;
+    size_t klen;
+
+    if ((parser = ucl_parser_new(UCL_PARSER_NO_FILEVARS)) == NULL)
+        errx(1, "ucl_parser_new");
+    if (!ucl_parser_add_chunk(parser, (const u_char *)manifest, len)) {
+        warnx("%s: %s", p->file, ucl_parser_get_error(parser));
+        ucl_parser_free(parser);
+        return (-1);
+    }
+    obj = ucl_parser_get_object(parser);
+    ucl_parser_free(parser);
+
+    name = ucl_object_lookup(obj, "name");
+    if (name == NULL || ucl_object_type(name) != UCL_STRING) {
+        warnx("%s: no package name", p->file);
+        ucl_object_unref(obj);
+        return (-1);
+    }
+    if (asprintf(&p->prefix, "%s*", ucl_object_tostring(name)) < 0)
+        err(1, "asprintf");
+
+    files = ucl_object_lookup(obj, "files");
+    while (files != NULL && (cur = ucl_object_iterate(files, &it, true))) {
+        if ((key = ucl_object_keyl(cur, &klen)) != NULL)
+            package_add(p, ucl_object_tostring(name), key, klen);
+    }
+    ucl_object_unref(obj);
+
+    package_index(p);
+    qsort(p->lines, p->nlines, sizeof(char *), strptrcmp);
+
+    return (0);
+}
+
+/*
+ * Load the entries of p from cachedir, if they were saved for an
+ * archive of the same size and mtime. A file cut short, which doesn't
+ * end with a newline, is stale too. Returns -1 if they weren't.
+ */
+static int
+cache_load(struct generator *g, struct package *p)
+{
+    struct stat sb;
+    char path[MAXPATHLEN], name[MAXPATHLEN];
+    char *nl;
+    long long size, mtime;
+    int fd, n;
+
+    snprintf(path, sizeof(path), "%s/%s", g->cachedir, p->file);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return (-1);
+    if (fstat(fd, &sb) != 0 || sb.st_size == 0 ||
+        (p->buf = malloc(sb.st_size + 1)) == NULL ||
+        read(fd, p->buf, sb.st_size) != sb.st_size) {
+        close(fd);
+        goto stale;
+    }
+    close(fd);
+    p->cap = sb.st_size + 1;
+    p->buf[sb.st_size] = '\0';
+
+    if (p->buf[sb.st_size - 1] != '\n' ||
+        (nl = strchr(p->buf, '\n')) == NULL ||
+        sscanf(p->buf, CACHE_MAGIC " %lld %lld %1023s%n", &size, &mtime,
+        name, &n) != 3 || p->buf + n != nl ||
+        size != p->size || mtime != p->mtime)
+        goto stale;
+    if (asprintf(&p->prefix, "%s*", name) < 0)
+        err(1, "asprintf");
+
+    /* the entries follow the header, sorted, one per line */
+    p->len = sb.st_size - (nl + 1 - p->buf);
+    memmove(p->buf, nl + 1, p->len);
+    for (nl = p->buf; (nl = memchr(nl, '\n', p->buf + p->len - nl)) != NULL;
+        nl++) {
+        *nl = '\0';
+        p->nlines++;
+    }
+    package_index(p);
+
+    return (0);
+
+stale:
+    free(p->buf);
+    p->buf = NULL;
+    p->cap = 0;
+    return (-1);
+}
+
+/*
+ * Save the entries of p to cachedir. The file is synced before being
+ * renamed, a crash leaves the previous one or the complete new one.
+ */
+static void
+cache_save(struct generator *g, struct package *p)
+{
+    char path[MAXPATHLEN], tmp[MAXPATHLEN];
+    FILE *fp;
+    size_t i;
+    int failed;
+
+    snprintf(path, sizeof(path), "%s/%s", g->cachedir, p->file);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((fp = fopen(tmp, "w")) == NULL) {
+        warn("%s", tmp);
+        return;
+    }
+    fprintf(fp, CACHE_MAGIC " %lld %lld %.*s\n", (long long)p->size,
+        (long long)p->mtime, (int)strlen(p->prefix) - 1, p->prefix);
+    for (i = 0; i < p->nlines; i++)
+        fprintf(fp, "%s\n", p->lines[i]);
+    failed = fflush(fp) != 0 || ferror(fp) || fsync(fileno(fp)) != 0;
+    if (fclose(fp) != 0 || failed || rename(tmp, path) != 0) {
+        warn("%s", path);
+        unlink(tmp);
+    }
+}
+
+/* Remove the files of cachedir left by the packages gone */
+static void
+cache_prune(struct generator *g)
+{
+    struct package key;
+    struct dirent *de;
+    char path[MAXPATHLEN];
+    DIR *dir;
+
+    if ((dir = opendir(g->cachedir)) == NULL)
+        err(1, "%s", g->cachedir);
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        key.file = de->d_name;
+        if (bsearch(&key, g->pkgs, g->npkgs, sizeof(*g->pkgs),
+            file_cmp) != NULL)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", g->cachedir, de->d_name);
+        if (unlink(path) != 0)
+            warn("%s", path);
+    }
+    closedir(dir);
+}
+
+/*
+ * Two archives of a package with the same name: merge the entries of
+ * the packages [first, last) of list into the first one.
+ */
+static void
+merge_packages(struct package **list, size_t first, size_t last)
+{
+    struct package *p = list[first];
+    size_t i, n = 0;
+
+    for (i = first; i < last; i++)
+        n += list[i]->nlines;
+    if (n == 0)
+        return;
+    if ((p->lines = realloc(p->lines, n * sizeof(char *))) == NULL)
+        err(1, "realloc");
+    for (i = first + 1; i < last; i++) {
+        memcpy(p->lines + p->nlines, list[i]->lines,
+            list[i]->nlines * sizeof(char *));
+        p->nlines += list[i]->nlines;
+        list[i]->nlines = 0;
+    }
+    qsort(p->lines, p->nlines, sizeof(char *), strptrcmp);
+}
+
+/*
+ * Sort the entries of the n packages of list into *linesp. "pkgname*"
+ * is never a prefix of another package's one, ordering the packages by
+ * it orders all their entries.
+ */
+static size_t
+run_sort(struct package **list, size_t n, char ***linesp)
+{
+    char **lines;
+    size_t i, j, nlines = 0;
+
+    qsort(list, n, sizeof(*list), package_cmp);
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n &&
+            strcmp(list[i]->prefix, list[j]->prefix) == 0; j++)
+            ;
+        if (j - i > 1)
+            merge_packages(list, i, j);
+    }
+
+    for (i = 0; i < n; i++)
+        nlines += list[i]->nlines;
+    if ((lines = malloc((nlines + 1) * sizeof(char *))) == NULL)
+        err(1, "malloc");
+    for (i = 0, nlines = 0; i < n; i++) {
+        memcpy(lines + nlines, list[i]->lines,
+            list[i]->nlines * sizeof(char *));
+        nlines += list[i]->nlines;
+    }
+    *linesp = lines;
+
+    return (nlines);
+}
+
+static void
+package_release(struct package *p)
+{
+    free(p->prefix);
+    free(p->buf);
+    free(p->lines);
+    p->prefix = p->buf = NULL;
+    p->lines = NULL;
+    p->len = p->cap = p->nlines = 0;
+}
+
+/* Sort the n packages of list and write their entries to a new run */
+static void
+run_spill(struct generator *g, struct package **list, size_t n)
+{
+    char path[MAXPATHLEN];
+    char **lines;
+    FILE *fp;
+    size_t i, nlines;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/provides-db-gen.XXXXXX", g->tmpdir);
+    if ((fd = mkstemp(path)) < 0)
+        err(1, "%s", path);
+    unlink(path);
+    if ((fp = fdopen(fd, "w+")) == NULL)
+        err(1, "fdopen");
+
+    nlines = run_sort(list, n, &lines);
+    for (i = 0; i < nlines; i++)
+        fprintf(fp, "%s\n", lines[i]);
+    if (fflush(fp) != 0 || ferror(fp))
+        err(1, "%s", path);
+    free(lines);
+    for (i = 0; i < n; i++)
+        package_release(list[i]);
+
+    pthread_mutex_lock(&g->lock);
+    if ((g->runs = realloc(g->runs, (g->nruns + 1) * sizeof(FILE *))) == NULL)
+        err(1, "realloc");
+    g->runs[g->nruns++] = fp;
+    pthread_mutex_unlock(&g->lock);
+}
+
+/*
+ * Queue the entries of p for the next run. The thread whose package
+ * takes the queue over runsize sorts it and writes it to disk, the
+ * others keep reading packages meanwhile.
+ */
+static void
+package_done(struct generator *g, struct package *p)
+{
+    struct package **list = NULL;
+    size_t n = 0;
+
+    pthread_mutex_lock(&g->lock);
+    if (g->npending == g->pendcap) {
+        g->pendcap = g->pendcap ? g->pendcap * 2 : 1024;
+        g->pending = realloc(g->pending, g->pendcap * sizeof(*g->pending));
+        if (g->pending == NULL)
+            err(1, "realloc");
+    }
+    g->pending[g->npending++] = p;
+    g->pendsize += p->cap + p->nlines * sizeof(char *);
+    if (g->runsize > 0 && g->pendsize >= g->runsize) {
+        list = g->pending;
+        n = g->npending;
+        g->pending = NULL;
+        g->npending = g->pendcap = g->pendsize = 0;
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    if (list != NULL) {
+        run_spill(g, list, n);
+        free(list);
+    }
+}
+
+static void *
+worker(void *arg)
+{
+    struct generator *g = arg;
+    struct package *p;
+    struct stat sb;
+    char path[MAXPATHLEN];
+    char *manifest;
+    size_t i, len;
+
+    while ((i = atomic_fetch_add(&g->next, 1)) < g->npkgs) {
+        p = &g->pkgs[i];
+        snprintf(path, sizeof(path), "%s/%s", g->dir, p->file);
+        if (stat(path, &sb) != 0) {
+            warn("%s", path);
+            atomic_fetch_add(&g->skipped, 1);
+            continue;
+        }
+        p->size = sb.st_size;
+        p->mtime = sb.st_mtime;
+        if (g->cachedir != NULL && cache_load(g, p) == 0) {
+            atomic_fetch_add(&g->cached, 1);
+            package_done(g, p);
+            continue;
+        }
+        manifest = read_manifest(path, &len);
+        if (manifest == NULL || package_parse(p, manifest, len) != 0) {
+            atomic_fetch_add(&g->skipped, 1);
+            free(manifest);
+            continue;
+        }
+        free(manifest);
+        if (g->cachedir != NULL)
+            cache_save(g, p);
+        package_done(g, p);
+    }
+
+    return (NULL);
+}
+
+static void
+source_next(struct source *s)
+{
+    ssize_t n;
+
+    if (s->fp == NULL) {
+        s->line = s->next < s->nlines ? s->lines[s->next++] : NULL;
+        return;
+    }
+    if ((n = getline(&s->buf, &s->cap, s->fp)) <= 0) {
+        if (ferror(s->fp))
+            err(1, "run");
+        s->line = NULL;
+        return;
+    }
+    if (s->buf[n - 1] == '\n')
+        s->buf[n - 1] = '\0';
+    s->line = s->buf;
+}
+
+static void
+source_rewind(struct source *s)
+{
+    if (s->fp != NULL && fseeko(s->fp, 0, SEEK_SET) != 0)
+        err(1, "run");
+    s->next = 0;
+    source_next(s);
+}
+
+/* Restore the heap order of the sources below heap[i] */
+static void
+heap_down(struct source **heap, size_t n, size_t i)
+{
+    struct source *s;
+    size_t c;
+
+    for (; (c = 2 * i + 1) < n; i = c) {
+        if (c + 1 < n && strcmp(heap[c + 1]->line, heap[c]->line) < 0)
+            c++;
+        if (strcmp(heap[i]->line, heap[c]->line) <= 0)
+            break;
+        s = heap[i];
+        heap[i] = heap[c];
+        heap[c] = s;
+    }
+}
+
+/* Strings interned by the v4 writer, numbered in sorted order */
+struct strset {
+    char **strs;                    /* open addressing */
+    uint32_t *ids;
+    size_t size;
+    size_t n;
+};
+
+/* The v4 database written next to the v3 one with -4 */
+struct v4writer {
+    FILE *fp;
+    const char *file;
+    uint64_t off;                   /* bytes written */
+    uint64_t sections[4];           /* see db4.h */
+    struct strset dirs;
+    struct strset basenames;
+    char **pkgs;                    /* package names, in database order */
+    uint32_t *nfiles;
+    uint64_t *records;              /* offsets of their records */
+    size_t npkgs;
+    size_t pkgcap;
+    uint64_t total;                 /* files */
+    size_t pkg;                     /* package being encoded, plus one */
+    uint32_t prevdir;
+};
+
+static size_t
+strset_slot(const struct strset *set, const char *s, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        h = (h ^ (u_char)s[i]) * 0x100000001b3ULL;
+    for (i = h & (set->size - 1); set->strs[i] != NULL;
+        i = (i + 1) & (set->size - 1))
+        if (strncmp(set->strs[i], s, len) == 0 && set->strs[i][len] == '\0')
+            break;
+
+    return (i);
+}
+
+/* Add the string s of len bytes, returns 0 if it was already there */
+static int
+strset_add(struct strset *set, const char *s, size_t len)
+{
+    struct strset old;
+    size_t i, j;
+
+    if (set->n * 2 >= set->size) {
+        old = *set;
+        set->size = old.size ? old.size * 2 : 65536;
+        set->strs = calloc(set->size, sizeof(char *));
+        set->ids = calloc(set->size, sizeof(uint32_t));
+        if (set->strs == NULL || set->ids == NULL)
+            err(1, "calloc");
+        for (i = 0; i < old.size; i++) {
+            if (old.strs[i] == NULL)
+                continue;
+            j = strset_slot(set, old.strs[i], strlen(old.strs[i]));
+            set->strs[j] = old.strs[i];
+        }
+        free(old.strs);
+        free(old.ids);
+    }
+    i = strset_slot(set, s, len);
+    if (set->strs[i] != NULL)
+        return (0);
+    if ((set->strs[i] = strndup(s, len)) == NULL)
+        err(1, "strndup");
+    set->n++;
+
+    return (1);
+}
+
+static uint32_t
+strset_id(const struct strset *set, const char *s, size_t len)
+{
+    return (set->ids[strset_slot(set, s, len)]);
+}
+
+/* Number the strings of set in sorted order, returns them in that order */
+static char **
+strset_sort(struct strset *set)
+{
+    char **list;
+    size_t i, n;
+
+    if ((list = malloc((set->n + 1) * sizeof(char *))) == NULL)
+        err(1, "malloc");
+    for (i = 0, n = 0; i < set->size; i++)
+        if (set->strs[i] != NULL)
+            list[n++] = set->strs[i];
+    qsort(list, n, sizeof(char *), strptrcmp);
+    for (i = 0; i < n; i++)
+        set->ids[strset_slot(set, list[i], strlen(list[i]))] = i;
+
+    return (list);
+}
+
+static void
+strset_free(struct strset *set)
+{
+    size_t i;
+
+    for (i = 0; i < set->size; i++)
+        free(set->strs[i]);
+    free(set->strs);
+    free(set->ids);
+}
+
+static void
+v4_write(struct v4writer *w, const void *buf, size_t len)
+{
+    if (len > 0 && fwrite(buf, len, 1, w->fp) != 1)
+        err(1, "%s", w->file);
+    w->off += len;
+}
+
+static void
+v4_write_le32(struct v4writer *w, uint32_t v)
+{
+    u_char buf[4];
+
+    buf[0] = v; buf[1] = v >> 8; buf[2] = v >> 16; buf[3] = v >> 24;
+    v4_write(w, buf, sizeof(buf));
+}
+
+static void
+v4_write_le64(struct v4writer *w, uint64_t v)
+{
+    v4_write_le32(w, (uint32_t)v);
+    v4_write_le32(w, (uint32_t)(v >> 32));
+}
+
+static size_t
+put_varint(u_char *p, uint32_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+
+    return (n);
+}
+
+static void
+v4_write_varint(struct v4writer *w, uint32_t v)
+{
+    u_char buf[5];
+
+    v4_write(w, buf, put_varint(buf, v));
+}
+
+/*
+ * Write the n sorted directories, the offsets of their blocks on the
+ * first pass, their entries on the second.
+ */
+static void
+v4_write_dirs(struct v4writer *w, char **dirs, size_t n)
+{
+    u_char buf[5];
+    const char *name;
+    uint32_t off, delta;
+    size_t i;
+    int pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0, off = 0; i < n; i++) {
+            /* the root has no parent and an empty name */
+            delta = 0;
+            if ((name = strrchr(dirs[i], '/')) != NULL) {
+                delta = i - strset_id(&w->dirs, dirs[i], name - dirs[i]);
+                name++;
+            } else {
+                name = dirs[i];
+            }
+            if (pass == 0) {
+                if (i % DB4_BLOCK == 0)
+                    v4_write_le32(w, off);
+                off += put_varint(buf, delta) + strlen(name) + 1;
+            } else {
+                v4_write_varint(w, delta);
+                v4_write(w, name, strlen(name) + 1);
+            }
+        }
+    }
+}
+
+/*
+ * Write the n sorted basenames, front coded within their block, the
+ * offsets of the blocks on the first pass, the entries on the second.
+ */
+static void
+v4_write_basenames(struct v4writer *w, char **names, size_t n)
+{
+    u_char buf[5];
+    uint32_t off;
+    size_t i, k;
+    int pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0, off = 0; i < n; i++) {
+            k = 0;
+            if (i % DB4_BLOCK != 0)
+                while (names[i][k] != '\0' && names[i][k] == names[i - 1][k])
+                    k++;
+            if (pass == 0) {
+                if (i % DB4_BLOCK == 0)
+                    v4_write_le32(w, off);
+                off += put_varint(buf, k) + strlen(names[i] + k) + 1;
+            } else {
+                v4_write_varint(w, k);
+                v4_write(w, names[i] + k, strlen(names[i] + k) + 1);
+            }
+        }
+    }
+}
+
+/* Split the "pkgname*path" line, NULL if it has no absolute path */
+static const char *
+v4_split(const char *line, size_t *namelen, const char **slash)
+{
+    const char *path;
+
+    if ((path = strchr(line, '*')) == NULL || path[1] != '/')
+        return (NULL);
+    *namelen = path - line;
+    *slash = strrchr(path, '/');
+
+    return (path + 1);
+}
+
+/* First pass: intern the directories, basenames and packages of line */
+static void
+v4_count(struct v4writer *w, const char *line)
+{
+    const char *path, *slash;
+    size_t n, len;
+
+    if ((path = v4_split(line, &n, &slash)) == NULL)
+        return;
+    if (w->npkgs == 0 || strncmp(w->pkgs[w->npkgs - 1], line, n) != 0 ||
+        w->pkgs[w->npkgs - 1][n] != '\0') {
+        if (w->npkgs == w->pkgcap) {
+            w->pkgcap = w->pkgcap ? w->pkgcap * 2 : 4096;
+            w->pkgs = realloc(w->pkgs, w->pkgcap * sizeof(char *));
+            w->nfiles = realloc(w->nfiles, w->pkgcap * sizeof(uint32_t));
+            w->records = realloc(w->records, w->pkgcap * sizeof(uint64_t));
+            if (w->pkgs == NULL || w->nfiles == NULL || w->records == NULL)
+                err(1, "realloc");
+        }
+        if ((w->pkgs[w->npkgs] = strndup(line, n)) == NULL)
+            err(1, "strndup");
+        w->nfiles[w->npkgs++] = 0;
+    }
+    w->nfiles[w->npkgs - 1]++;
+    w->total++;
+
+    /* the directory and its ancestors, up to a known one */
+    len = slash - path;
+    while (strset_add(&w->dirs, path, len) && len > 0)
+        while (path[--len] != '/')
+            ;
+    strset_add(&w->basenames, slash + 1, strlen(slash + 1));
+}
+
+/* Between the passes: number the strings, write the tables of the ids */
+static void
+v4_start(struct v4writer *w)
+{
+    char **dirs, **basenames;
+
+    /* the root, even in an empty database */
+    strset_add(&w->dirs, "", 0);
+    dirs = strset_sort(&w->dirs);
+    basenames = strset_sort(&w->basenames);
+
+    v4_write(w, DB4_MAGIC, DB4_MAGIC_SIZE);
+    w->sections[0] = w->off;
+    v4_write_dirs(w, dirs, w->dirs.n);
+    w->sections[1] = w->off;
+    v4_write_basenames(w, basenames, w->basenames.n);
+    w->sections[2] = w->off;
+    free(dirs);
+    free(basenames);
+}
+
+/* Second pass: write the record of line */
+static void
+v4_line(struct v4writer *w, const char *line)
+{
+    const char *path, *slash;
+    uint32_t dir, delta;
+    size_t n;
+
+    if ((path = v4_split(line, &n, &slash)) == NULL)
+        return;
+    if (w->pkg == 0 || strncmp(w->pkgs[w->pkg - 1], line, n) != 0 ||
+        w->pkgs[w->pkg - 1][n] != '\0') {
+        w->records[w->pkg++] = w->off - w->sections[2];
+        w->prevdir = 0;
+    }
+    dir = strset_id(&w->dirs, path, slash - path);
+    delta = dir - w->prevdir;
+    /* zigzag, small negative differences stay small */
+    v4_write_varint(w, delta << 1 ^ -(delta >> 31));
+    v4_write_varint(w, strset_id(&w->basenames, slash + 1,
+        strlen(slash + 1)));
+    w->prevdir = dir;
+}
+
+/* Write the package table and the trailer */
+static void
+v4_finish(struct v4writer *w)
+{
+    size_t i;
+    uint32_t off;
+
+    w->sections[3] = w->off;
+    for (i = 0, off = 0; i < w->npkgs; i++) {
+        v4_write_le32(w, off);
+        v4_write_le32(w, w->nfiles[i]);
+        v4_write_le64(w, w->records[i]);
+        off += strlen(w->pkgs[i]) + 1;
+    }
+    for (i = 0; i < w->npkgs; i++)
+        v4_write(w, w->pkgs[i], strlen(w->pkgs[i]) + 1);
+
+    for (i = 0; i < 4; i++)
+        v4_write_le64(w, w->sections[i]);
+    v4_write_le32(w, w->dirs.n);
+    v4_write_le32(w, w->basenames.n);
+    v4_write_le32(w, w->npkgs);
+    v4_write_le32(w, 0);
+    v4_write_le64(w, w->total);
+    v4_write(w, DB4_MAGIC, DB4_MAGIC_SIZE);
+
+    for (i = 0; i < w->npkgs; i++)
+        free(w->pkgs[i]);
+    free(w->pkgs);
+    free(w->nfiles);
+    free(w->records);
+    strset_free(&w->dirs);
+    strset_free(&w->basenames);
+}
+
+/*
+ * Merge the sorted sources into the database, twice: once for the
+ * bigram statistics and the strings of the v4 database w, when not
+ * NULL, once to encode. Returns the number of entries.
+ */
+static size_t
+encode(struct bigram_encoder *e, struct v4writer *w, struct source *src,
+    size_t nsrc)
+{
+    struct source **heap, *s;
+    char prev[MAXPATHLEN];
+    size_t i, n, nentries = 0;
+    int pass;
+
+    if ((heap = calloc(nsrc, sizeof(*heap))) == NULL)
+        err(1, "calloc");
+
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            bigram_encode_table(e);
+            if (w != NULL)
+                v4_start(w);
+        }
+        for (i = 0, n = 0; i < nsrc; i++) {
+            source_rewind(&src[i]);
+            if (src[i].line != NULL)
+                heap[n++] = &src[i];
+        }
+        for (i = n / 2; i-- > 0;)
+            heap_down(heap, n, i);
+
+        prev[0] = '\0';
+        while (n > 0) {
+            s = heap[0];
+            /* a file listed twice */
+            if (strcmp(s->line, prev) != 0) {
+                if (pass == 0) {
+                    bigram_encode_count(e, s->line);
+                    if (w != NULL)
+                        v4_count(w, s->line);
+                } else {
+                    bigram_encode_line(e, s->line);
+                    if (w != NULL)
+                        v4_line(w, s->line);
+                    nentries++;
+                }
+                strlcpy(prev, s->line, sizeof(prev));
+            }
+            source_next(s);
+            if (s->line == NULL)
+                heap[0] = heap[--n];
+            heap_down(heap, n, 0);
+        }
+    }
+    free(heap);
+
+    return (nentries);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: provides-db-gen [-j jobs] [-c cachedir] "
+        "[-m megabytes] [-T tmpdir] [-4 v4file] pkgdir dbfile\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct generator g;
+    struct bigram_encoder *e;
+    struct v4writer *w = NULL;
+    struct source *src;
+    struct dirent *de;
+    pthread_t *threads;
+    DIR *dir;
+    FILE *fp;
+    size_t cap = 0, i, n, memcap = 1024, nentries;
+    int ch, njobs = 0, started;
+
+    memset(&g, 0, sizeof(g));
+    if ((g.tmpdir = getenv("TMPDIR")) == NULL)
+        g.tmpdir = "/tmp";
+    while ((ch = getopt(argc, argv, "4:c:j:m:T:")) != -1) {
+        switch (ch) {
+        case '4':
+            if ((w = calloc(1, sizeof(*w))) == NULL)
+                err(1, "calloc");
+            w->file = optarg;
+            break;
+        case 'c':
+            g.cachedir = optarg;
+            break;
+        case 'j':
+            njobs = atoi(optarg);
+            break;
+        case 'm':
+            memcap = strtoul(optarg, NULL, 10);
+            break;
+        case 'T':
+            g.tmpdir = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 2)
+        usage();
+    if (njobs < 1)
+        njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (njobs < 1)
+        njobs = 1;
+
+    g.dir = argv[0];
+    if ((dir = opendir(g.dir)) == NULL)
+        err(1, "%s", g.dir);
+    while ((de = readdir(dir)) != NULL) {
+        n = strlen(de->d_name);
+        if (n <= 4 || strcmp(de->d_name + n - 4, ".pkg") != 0)
+            continue;
+        if (g.npkgs == cap) {
+            cap = cap ? cap * 2 : 1024;
+            if ((g.pkgs = realloc(g.pkgs, cap * sizeof(*g.pkgs))) == NULL)
+                err(1, "realloc");
+        }
+        memset(&g.pkgs[g.npkgs], 0, sizeof(*g.pkgs));
+        if ((g.pkgs[g.npkgs++].file = strdup(de->d_name)) == NULL)
+            err(1, "strdup");
+    }
+    closedir(dir);
+    qsort(g.pkgs, g.npkgs, sizeof(*g.pkgs), file_cmp);
+
+    if (g.cachedir != NULL) {
+        if (mkdir(g.cachedir, 0755) != 0 && errno != EEXIST)
+            err(1, "%s", g.cachedir);
+        cache_prune(&g);
+    }
+
+    if ((size_t)njobs > g.npkgs)
+        njobs = g.npkgs > 0 ? g.npkgs : 1;
+    /*
+     * Every thread may be writing a run while the next one fills up,
+     * each run gets its share of the memory cap.
+     */
+    g.runsize = memcap * 1024 * 1024 / (njobs + 1);
+
+    atomic_init(&g.next, 0);
+    atomic_init(&g.skipped, 0);
+    atomic_init(&g.cached, 0);
+    pthread_mutex_init(&g.lock, NULL);
+    if ((threads = calloc(njobs, sizeof(pthread_t))) == NULL)
+        err(1, "calloc");
+    for (started = 0; started < njobs; started++) {
+        if (pthread_create(&threads[started], NULL, worker, &g) != 0)
+            break;
+    }
+    if (started == 0)
+        worker(&g);
+    while (started > 0)
+        pthread_join(threads[--started], NULL);
+    free(threads);
+
+    /* the runs on disk, then the packages left in memory */
+    if ((src = calloc(g.nruns + 1, sizeof(*src))) == NULL)
+        err(1, "calloc");
+    for (i = 0; i < g.nruns; i++)
+        src[i].fp = g.runs[i];
+    src[i].nlines = run_sort(g.pending, g.npending, &src[i].lines);
+
+    if ((e = malloc(sizeof(*e))) == NULL)
+        err(1, "malloc");
+    if (strcmp(argv[1], "-") == 0)
+        fp = stdout;
+    else if ((fp = fopen(argv[1], "w")) == NULL)
+        err(1, "%s", argv[1]);
+    setvbuf(fp, NULL, _IOFBF, 1024 * 1024);
+    if (w != NULL) {
+        if ((w->fp = fopen(w->file, "w")) == NULL)
+            err(1, "%s", w->file);
+        setvbuf(w->fp, NULL, _IOFBF, 1024 * 1024);
+    }
+    bigram_encode_init(e, fp);
+    nentries = encode(e, w, src, g.nruns + 1);
+    if (ferror(fp) || fclose(fp) != 0)
+        err(1, "%s", argv[1]);
+    if (w != NULL) {
+        v4_finish(w);
+        if (ferror(w->fp) || fclose(w->fp) != 0)
+            err(1, "%s", w->file);
+    }
+
+    fprintf(stderr, "%zu packages, %zu entries", g.npkgs - g.skipped,
+        nentries);
+    if (g.cachedir != NULL)
+        fprintf(stderr, ", %d packages unchanged", g.cached);
+    if (g.nruns > 0)
+        fprintf(stderr, ", %zu runs", g.nruns);
+    if (g.skipped > 0)
+        fprintf(stderr, ", %d packages skipped", g.skipped);
+    fprintf(stderr, "\n");
+
+    return (0);
+}
@@ -30,56 +30,36 @@
 #include <unistd.h>
 #include <pkg.h>
 #include <curl/curl.h>
+#include <ctype.h>
 #include <errno.h>
+#include <getopt.h>
 #include <strings.h>
-#include <archive.h>
 #include <fcntl.h>
 #include <string.h>
-#include <archive_entry.h>
+#include <lzma.h>
+#include <sha256.h>
+#include <zstd.h>
 #include <pcre2.h>
-#include <libgen.h>
+#include <sys/param.h>
+#include <sys/mman.h>
 #include <sys/sysctl.h>
 #include <sys/queue.h>
 
+#include "bigram.h"
+#include "provides.h"
+
 static char myname[] = "provides";
 static char myversion[] = "0.8.0";
-static char dbversion[] = "v3";
+/* database formats, the preferred first, older servers only have v3 */
+static const char *dbversions[] = { "v4", "v3" };
 static char mydescription[] = "A plugin for querying which package provides a particular file";
 static struct pkg_plugin *self;
 bool force_flag = false;
 
 bool fetch_on_update = true;
 
-typedef struct file_t {
-    char *name;
-    SLIST_ENTRY (file_t) next;
-} file_t;
-SLIST_HEAD (file_head_t, file_t);
-
-typedef struct fpkg_t {
-    char *pkg_name;
-    struct file_head_t files;
-    SLIST_ENTRY (fpkg_t) next;
-} fpkg_t;
-SLIST_HEAD (pkg_head_t, fpkg_t);
-
-struct search_t {
-    struct pkg_head_t head;
-    pcre2_code *regex;
-    fpkg_t *pnode;
-    char * pattern;
-    pcre2_match_data *match_data;
-};
-
-void provides_progressbar_start(const char *pmsg);
-void provides_progressbar_stop(void);
-void provides_progressbar_tick(int64_t current, int64_t total);
-int mkpath(char *path);
-int bigram_expand(FILE *fp, void (*match_cb)(const char *,struct search_t *), void *extra);
-
-int config_fetch_on_update();
-char *config_get_remote_srv();
-char *config_get_filepath();
+/* One handle for all transfers, they share its connection cache */
+static CURL *curl_handle;
 
 #define BUFLEN 4096
 #define MAX_FN_SIZE 255
@@ -88,18 +68,25 @@ char *config_get_filepath();
 int
 pkg_plugin_shutdown(struct pkg_plugin *p __unused)
 {
-    /* nothing to be done here */
+    if (curl_handle != NULL) {
+        curl_easy_cleanup(curl_handle);
+        curl_handle = NULL;
+    }
     return (EPKG_OK);
 }
 
 void
 plugin_provides_usage(void)
 {
-    fprintf(stderr, "usage: pkg %s [-uf] [-r repo] pattern\n\n", myname);
+    fprintf(stderr, "usage: pkg %s [-uf] [-r repo] [--stats[=json]] pattern\n", myname);
+    fprintf(stderr, "       pkg %s [-r repo] [--stats[=json]] -e path\n", myname);
+    fprintf(stderr, "       pkg %s [-r repo] [--stats[=json]] -l pkgname\n", myname);
+    fprintf(stderr, "       pkg %s -b file\n", myname);
+    fprintf(stderr, "       pkg %s -d\n\n", myname);
     fprintf(stderr, "%s\n", mydescription);
 }
 
-int get_filepath(char *filename, size_t size)
+int get_filepath(char *filename, size_t size, const char *dbversion)
 {
     static char osver[1024];
     static char arch[1024];
@@ -155,88 +142,237 @@ int get_filepath(char *filename, size_t size)
     return (0);
 }
 
-int
-plugin_archive_extract(int fd, const char *out)
+#define DECODER_XZ      0
+#define DECODER_ZSTD    1
+#define DECODER_DIGEST  2           /* sha256 of a database, kept in digest */
+
+#define DIGEST_LEN      64
+
+/* zstd window needed to reach the whole base of a delta */
+#define DELTA_WINDOWLOG_MAX (sizeof(void *) == 4 ? 30 : 31)
+
+struct curl_write_data {
+    int fd;
+    int64_t size;
+    int64_t total_size;
+    int decoder;
+    lzma_stream strm;
+    ZSTD_DCtx *dctx;
+    bool done;                      /* end of the compressed stream */
+    char etag[256];                 /* ETag of the last reply */
+    char digest[DIGEST_LEN + 64];
+    size_t digest_len;
+};
+
+static int
+write_all(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t written;
+
+    while (len > 0) {
+        written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;  // Interrupted by signal, retry
+            }
+            return (-1);
+        }
+        buf += written;
+        len -= written;
+    }
+
+    return (0);
+}
+
+/*
+ * Prepare data to decode a stream of the given format. A zstd stream
+ * can be a patch against prefix, which must stay mapped until
+ * decoder_end().
+ */
+static int
+decoder_init(struct curl_write_data *data, int decoder, const void *prefix,
+    size_t prefix_len)
 {
+    lzma_stream strm = LZMA_STREAM_INIT;
+    lzma_ret ret;
+#if LZMA_VERSION >= 50040002
+    lzma_mt mt;
+#endif
 
-    struct archive_entry *ae = NULL;
-    struct archive *ar = NULL;
-    int fd_out = -1;
+    data->decoder = decoder;
+    data->size = 0;
+    data->total_size = 0;
+    data->done = false;
 
-    fd_out = open(out, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if ( fd_out < 0) {
-        return -1;
+    if (decoder == DECODER_DIGEST) {
+        data->digest_len = 0;
+        return (0);
+    }
+    if (decoder == DECODER_XZ) {
+        data->strm = strm;
+#if LZMA_VERSION >= 50040002
+        /* blocks of a multi-block stream (xz -T) are decoded in parallel */
+        memset(&mt, 0, sizeof(mt));
+        mt.flags = LZMA_CONCATENATED;
+        mt.threads = config_jobs();
+        mt.memlimit_threading = lzma_physmem() / 4;
+        mt.memlimit_stop = UINT64_MAX;
+        ret = lzma_stream_decoder_mt(&data->strm, &mt);
+#else
+        ret = lzma_stream_decoder(&data->strm, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+        if (ret != LZMA_OK) {
+            fprintf(stderr, "lzma_stream_decoder failed\n");
+            return (-1);
+        }
+        return (0);
     }
 
-    ar = archive_read_new();
-    if (ar == NULL) {
-        goto error;
+    data->dctx = ZSTD_createDCtx();
+    if (data->dctx == NULL) {
+        fprintf(stderr, "ZSTD_createDCtx failed\n");
+        return (-1);
+    }
+    if (prefix != NULL &&
+        (ZSTD_isError(ZSTD_DCtx_setParameter(data->dctx, ZSTD_d_windowLogMax, DELTA_WINDOWLOG_MAX)) ||
+        ZSTD_isError(ZSTD_DCtx_refPrefix(data->dctx, prefix, prefix_len)))) {
+        fprintf(stderr, "Could not load the delta base\n");
+        return (-1);
     }
 
-    archive_read_support_filter_all(ar);
-    archive_read_support_format_raw(ar);
+    return (0);
+}
 
-    int r = archive_read_open_fd(ar, fd, BUFLEN);
-    if (r != ARCHIVE_OK) {
-        fprintf(stderr, "archive_read_open_fd failed: %s\n", archive_error_string(ar));
-        goto error;
+static void
+decoder_end(struct curl_write_data *data)
+{
+    if (data->decoder == DECODER_XZ) {
+        lzma_end(&data->strm);
+    } else if (data->decoder == DECODER_ZSTD) {
+        ZSTD_freeDCtx(data->dctx);
+        data->dctx = NULL;
     }
+}
 
-    r = archive_read_next_header(ar, &ae);
-    if (r != ARCHIVE_OK) {
-        fprintf(stderr, "archive_read_next_header failed: %s\n", archive_error_string(ar));
-        goto error;
+/*
+ * Collect the published sha256 of a database, as written by sha256 -q.
+ * With finish set it must be complete.
+ */
+static int
+digest_run(struct curl_write_data *data, const uint8_t *in, size_t len,
+    bool finish)
+{
+    size_t i;
+
+    if (len > sizeof(data->digest) - 1 - data->digest_len) {
+        fprintf(stderr, "Invalid database digest\n");
+        return (-1);
+    }
+    memcpy(data->digest + data->digest_len, in, len);
+    data->digest_len += len;
+    data->digest[data->digest_len] = '\0';
+    if (!finish) {
+        return (0);
     }
 
-    if (archive_read_data_into_fd(ar, fd_out) != 0) {
-        fprintf(stderr, "archive_read_data failed: %s\n", archive_error_string(ar));
-        goto error;
+    while (data->digest_len > 0 &&
+        isspace((unsigned char)data->digest[data->digest_len - 1])) {
+        data->digest[--data->digest_len] = '\0';
+    }
+    for (i = 0; i < data->digest_len; i++) {
+        data->digest[i] = tolower((unsigned char)data->digest[i]);
+    }
+    if (data->digest_len != DIGEST_LEN ||
+        strspn(data->digest, "0123456789abcdef") != DIGEST_LEN) {
+        fprintf(stderr, "Invalid database digest\n");
+        return (-1);
     }
 
-    archive_read_free(ar);
-    close(fd_out);
     return (0);
+}
 
-error:
-    if (fd_out) {
-        close(fd);
-        unlink(out);
+/*
+ * Decode len bytes of in and write the result to the database. With
+ * finish set the decoder is flushed and the stream must be complete.
+ */
+static int
+decoder_run(struct curl_write_data *data, const uint8_t *in, size_t len,
+    bool finish)
+{
+    uint8_t out[BUFLEN * 16];
+    ZSTD_inBuffer zin = { in, len, 0 };
+    ZSTD_outBuffer zout;
+    size_t zret;
+    lzma_ret ret;
+
+    if (data->decoder == DECODER_DIGEST) {
+        return (digest_run(data, in, len, finish));
     }
-    return -1;
-}
 
-struct curl_write_data {
-    int fd;
-    int64_t size;
-    int64_t total_size;
-};
+    data->strm.next_in = in;
+    data->strm.avail_in = len;
+
+    for (;;) {
+        if (data->decoder == DECODER_XZ) {
+            if (data->done || (data->strm.avail_in == 0 && !finish)) {
+                break;
+            }
+            data->strm.next_out = out;
+            data->strm.avail_out = sizeof(out);
+            ret = lzma_code(&data->strm, finish ? LZMA_FINISH : LZMA_RUN);
+            if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+                fprintf(stderr, "Could not decompress the database: lzma error %d\n", ret);
+                return (-1);
+            }
+            data->done = (ret == LZMA_STREAM_END);
+            zout.pos = sizeof(out) - data->strm.avail_out;
+        } else {
+            if (zin.pos == zin.size && (!finish || data->done)) {
+                break;
+            }
+            zout.dst = out;
+            zout.size = sizeof(out);
+            zout.pos = 0;
+            zret = ZSTD_decompressStream(data->dctx, &zout, &zin);
+            if (ZSTD_isError(zret)) {
+                fprintf(stderr, "Could not decompress the database: %s\n", ZSTD_getErrorName(zret));
+                return (-1);
+            }
+            data->done = (zret == 0);
+            if (finish && !data->done && zout.pos == 0) {
+                fprintf(stderr, "Could not decompress the database: truncated data\n");
+                return (-1);
+            }
+        }
+        if (write_all(data->fd, out, zout.pos) != 0) {
+            fprintf(stderr, "Could not write the database: %s\n", strerror(errno));
+            return (-1);
+        }
+    }
+
+    return (0);
+}
 
+/*
+ * Decompress the received data as it arrives and write it to the
+ * database, so the extraction overlaps the transfer.
+ */
 static size_t
 provides_write_callback(void *ptr, size_t size, size_t nmemb, void *userdata)
 {
     struct curl_write_data *data = (struct curl_write_data *)userdata;
     size_t total = size * nmemb;
-    ssize_t written = 0;
-    ssize_t bytes_written = 0;
 
-    while (bytes_written < total) {
-        written = write(data->fd, (char *)ptr + bytes_written, total - bytes_written);
-        if (written < 0) {
-            if (errno == EINTR) {
-                continue;  // Interrupted by signal, retry
-            }
-            fprintf(stderr, "Could not write to temporary file: %s\n", strerror(errno));
-            return 0;  // Signal error to curl
-        }
-        bytes_written += written;
+    if (decoder_run(data, ptr, total, false) != 0) {
+        return 0;  // Signal error to curl
     }
 
-    data->size += bytes_written;
+    data->size += total;
     if (data->total_size > 0) {
         provides_progressbar_tick(data->size, data->total_size);
     }
 
-    return bytes_written;
+    return total;
 }
 
 static int
@@ -252,213 +388,595 @@ provides_progress_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
     return 0;
 }
 
+/*
+ * Record the ETag of the reply, headers of intermediate replies
+ * (redirections) are dropped at each status line.
+ */
+static size_t
+provides_header_callback(char *buf, size_t size, size_t nitems, void *userdata)
+{
+    struct curl_write_data *data = (struct curl_write_data *)userdata;
+    size_t len = size * nitems;
+    size_t vlen;
+    char *value;
+
+    if (len >= 5 && strncmp(buf, "HTTP/", 5) == 0) {
+        data->etag[0] = '\0';
+    } else if (len > 5 && strncasecmp(buf, "etag:", 5) == 0) {
+        value = buf + 5;
+        vlen = len - 5;
+        while (vlen > 0 && (*value == ' ' || *value == '\t')) {
+            value++;
+            vlen--;
+        }
+        while (vlen > 0 && (value[vlen - 1] == '\r' || value[vlen - 1] == '\n' ||
+            value[vlen - 1] == ' ')) {
+            vlen--;
+        }
+        if (vlen < sizeof(data->etag)) {
+            memcpy(data->etag, value, vlen);
+            data->etag[vlen] = '\0';
+        }
+    }
+
+    return len;
+}
+
+static CURL *
+provides_curl(void)
+{
+    if (curl_handle == NULL) {
+        curl_handle = curl_easy_init();
+    } else {
+        curl_easy_reset(curl_handle);
+    }
+
+    return (curl_handle);
+}
+
+static void
+read_etag(char *etag, size_t size)
+{
+    FILE *fp;
+
+    etag[0] = '\0';
+    if ((fp = fopen(PKG_DB_PATH "provides.db.etag", "r")) == NULL) {
+        return;
+    }
+    if (fgets(etag, size, fp) == NULL) {
+        etag[0] = '\0';
+    }
+    etag[strcspn(etag, "\r\n")] = '\0';
+    fclose(fp);
+}
+
+static void
+write_etag(const char *etag)
+{
+    FILE *fp;
+
+    if (etag[0] == '\0' ||
+        (fp = fopen(PKG_DB_PATH "provides.db.etag", "w")) == NULL) {
+        unlink(PKG_DB_PATH "provides.db.etag");
+        return;
+    }
+    fprintf(fp, "%s\n", etag);
+    fclose(fp);
+}
+
+#define FETCH_OK            0
+#define FETCH_NOTFOUND      1
+#define FETCH_NOTMODIFIED   2
+
+/*
+ * Download url into the database open on data->fd, through the decoder
+ * set up in data, with a progress bar showing msg unless it is NULL.
+ * When etag or since is set the request is conditional. Returns one of
+ * the FETCH_ values, -1 on error.
+ */
 static int
-curl_get_mtime(const char *url, time_t *mtime)
+fetch_url(const char *url, struct curl_write_data *data, const char *msg,
+    const char *etag, time_t since)
 {
     CURL *curl;
     CURLcode res;
-    long response_code;
-    long file_time;
+    struct curl_slist *headers = NULL;
+    char buf[sizeof(data->etag) + 32];
+    long response_code = 0;
+    long unmet = 0;
 
-    curl = curl_easy_init();
+    curl = provides_curl();
     if (!curl) {
         fprintf(stderr, "curl_easy_init failed\n");
-        return -1;
+        return (-1);
     }
 
     curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);  // HEAD request
-    curl_easy_setopt(curl, CURLOPT_FILETIME, 1L);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, provides_write_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, provides_header_callback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, provides_progress_callback);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, data);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, data);
+
+    if (since > 0) {
+        curl_easy_setopt(curl, CURLOPT_TIMECONDITION, (long)CURL_TIMECOND_IFMODSINCE);
+        curl_easy_setopt(curl, CURLOPT_TIMEVALUE_LARGE, (curl_off_t)since);
+    }
+    if (etag != NULL && etag[0] != '\0') {
+        snprintf(buf, sizeof(buf), "If-None-Match: %s", etag);
+        headers = curl_slist_append(headers, buf);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    }
+
+    data->etag[0] = '\0';
+
+    if (msg != NULL) {
+        provides_progressbar_start(msg);
+    }
 
     res = curl_easy_perform(curl);
 
+    if (msg != NULL) {
+        provides_progressbar_stop();
+    }
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    curl_easy_getinfo(curl, CURLINFO_CONDITION_UNMET, &unmet);
+    curl_slist_free_all(headers);
+
+    if (res == CURLE_HTTP_RETURNED_ERROR &&
+        (response_code == 404 || response_code == 410)) {
+        return (FETCH_NOTFOUND);
+    }
     if (res != CURLE_OK) {
-        fprintf(stderr, "curl HEAD request failed: %s\n", curl_easy_strerror(res));
-        curl_easy_cleanup(curl);
-        return -1;
+        fprintf(stderr, "curl download failed: %s\n", curl_easy_strerror(res));
+        return (-1);
+    }
+    if (response_code == 304 || unmet) {
+        return (FETCH_NOTMODIFIED);
     }
 
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-    if (response_code != 200) {
-        fprintf(stderr, "HTTP error: %ld\n", response_code);
-        curl_easy_cleanup(curl);
-        return -1;
+    return (decoder_run(data, NULL, 0, true));
+}
+
+/* Compute the sha256 of the file open on fd. Returns -1 on error */
+static int
+file_digest(int fd, char *digest)
+{
+    SHA256_CTX ctx;
+    struct stat sb;
+    void *p;
+
+    if (fstat(fd, &sb) != 0) {
+        return (-1);
     }
+    SHA256_Init(&ctx);
+    if (sb.st_size > 0) {
+        p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            return (-1);
+        }
+        SHA256_Update(&ctx, p, sb.st_size);
+        munmap(p, sb.st_size);
+    }
+    SHA256_End(&ctx, digest);
 
-    res = curl_easy_getinfo(curl, CURLINFO_FILETIME, &file_time);
-    if (res == CURLE_OK && file_time >= 0) {
-        *mtime = (time_t)file_time;
-    } else {
-        *mtime = 0;
+    return (0);
+}
+
+/*
+ * Fetch the sha256 of the database published under filepath, which the
+ * server writes to provides.db.sha256 once the database and its deltas
+ * are in place. When etag or since is set the request is conditional.
+ * Returns one of the FETCH_ values, -1 on error.
+ */
+static int
+fetch_digest(const char *filepath, struct curl_write_data *data,
+    const char *etag, time_t since, char *digest)
+{
+    char url[MAXPATHLEN + 1];
+    int r;
+
+    snprintf(url, MAXPATHLEN, "%s/%s/provides.db.sha256", config_get_remote_srv(), filepath);
+    r = decoder_init(data, DECODER_DIGEST, NULL, 0);
+    if (r == 0) {
+        r = fetch_url(url, data, NULL, etag, since);
+    }
+    decoder_end(data);
+    if (r == FETCH_OK) {
+        strlcpy(digest, data->digest, DIGEST_LEN + 1);
     }
 
-    curl_easy_cleanup(curl);
-    return 0;
+    return (r);
 }
 
-int
-plugin_fetch_file(void)
+/*
+ * Rebuild the new database from a delta against the local one. The
+ * server publishes deltas/<sha256 of the old database>.zst, made with
+ * zstd --patch-from, for the last few databases it generated. The
+ * result must have the sha256 target, a delta left over from an older
+ * database rebuilds that one.
+ * Returns one of the FETCH_ values, FETCH_NOTMODIFIED when the local
+ * database already is the target, -1 on error.
+ */
+static int
+fetch_delta(const char *filepath, struct curl_write_data *data,
+    const char *target)
 {
-    CURL *curl;
-    CURLcode res;
-    int fo;
-    time_t remote_mtime = 0;
-    struct curl_write_data write_data;
-    char tmpfile[] = "/var/tmp/pkg-provides-XXXX";
+    SHA256_CTX ctx;
     struct stat sb;
-    char path[] = PKG_DB_PATH;
-    char filepath[MAX_FN_SIZE + 1];
     char url[MAXPATHLEN + 1];
+    char digest[65];
+    void *db;
+    int fd, ret;
 
-    if (get_filepath(filepath, MAX_FN_SIZE) != 0) {
-        fprintf(stderr, "Can't get the OS ABI\n");
-        return (-1);
+    fd = open(PKG_DB_PATH "provides.db", O_RDONLY);
+    if (fd < 0) {
+        return (FETCH_NOTFOUND);
+    }
+    if (fstat(fd, &sb) != 0 || sb.st_size == 0) {
+        close(fd);
+        return (FETCH_NOTFOUND);
+    }
+    db = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (db == MAP_FAILED) {
+        return (FETCH_NOTFOUND);
     }
 
-    snprintf(url, MAXPATHLEN, "%s/%s/provides.db.xz", config_get_remote_srv(), filepath);
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, db, sb.st_size);
+    SHA256_End(&ctx, digest);
+    if (strcmp(digest, target) == 0) {
+        munmap(db, sb.st_size);
+        return (FETCH_NOTMODIFIED);
+    }
 
-    bool file_exists = (stat(PKG_DB_PATH "provides.db", &sb) == 0);
+    snprintf(url, MAXPATHLEN, "%s/%s/deltas/%s.zst", config_get_remote_srv(), filepath, digest);
 
-    if (!file_exists) {
-        // Database doesn't exist, ensure directory exists
-        if (mkpath(path) != 0) {
-            fprintf(stderr, "Insufficient privileges to update the provides database.\n");
+    ret = decoder_init(data, DECODER_ZSTD, db, sb.st_size);
+    if (ret == 0) {
+        ret = fetch_url(url, data, "Fetching provides database delta", NULL, 0);
+    }
+    decoder_end(data);
+    munmap(db, sb.st_size);
+
+    if (ret == FETCH_OK &&
+        (file_digest(data->fd, digest) != 0 || strcmp(digest, target) != 0)) {
+        fprintf(stderr, "The database rebuilt from the delta is not the published one\n");
+        ret = -1;
+    }
+
+    return (ret);
+}
+
+/*
+ * Download the whole database. The zstd variant is preferred when the
+ * server publishes one, it decodes several times faster than xz. When
+ * etag or since is set the request is conditional.
+ * Returns one of the FETCH_ values, -1 on error.
+ */
+static int
+fetch_full(const char *filepath, struct curl_write_data *data,
+    const char *etag, time_t since)
+{
+    static const struct {
+        const char *ext;
+        int decoder;
+    } formats[] = {
+        { "zst", DECODER_ZSTD },
+        { "xz", DECODER_XZ },
+    };
+    char url[MAXPATHLEN + 1];
+    size_t i;
+    int r = FETCH_NOTFOUND;
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (ftruncate(data->fd, 0) != 0 || lseek(data->fd, 0, SEEK_SET) != 0) {
+            fprintf(stderr, "Could not write the database: %s\n", strerror(errno));
             return (-1);
         }
-    } else if (!force_flag) {
-        // File exists, check if remote is newer (only if not forced)
-        if (curl_get_mtime(url, &remote_mtime) != 0) {
-            fprintf(stderr, "Failed to get remote file info: %s\n", url);
-            return -1;
+        snprintf(url, MAXPATHLEN, "%s/%s/provides.db.%s", config_get_remote_srv(), filepath, formats[i].ext);
+        r = decoder_init(data, formats[i].decoder, NULL, 0);
+        if (r == 0) {
+            r = fetch_url(url, data, "Fetching provides database", etag, since);
         }
-        if (remote_mtime > 0 && remote_mtime < sb.st_mtim.tv_sec) {
-            printf("The provides database is up-to-date.\n");
-            return (0);
+        decoder_end(data);
+        if (r != FETCH_NOTFOUND) {
+            break;
         }
     }
 
-    fo = mkstemp(tmpfile);
-    if (fo < 0) {
-        fprintf(stderr, "mkstemp failed: %s\n", strerror(errno));
-        goto error;
-    }
+    return (r);
+}
 
-    unlink(tmpfile);
+/*
+ * Download the database published under filepath into data->fd, from a
+ * delta against the local database when sb, its status, is not NULL.
+ * etag holds the entity tag of the local database and receives the one
+ * of the new database. All the requests go through the same connection,
+ * none of them is cut short. Returns one of the FETCH_ values, -1 on
+ * error.
+ */
+static int
+fetch_database(const char *filepath, struct curl_write_data *data,
+    const struct stat *sb, char *etag, size_t etagsize)
+{
+    char newetag[sizeof(data->etag)];
+    char target[DIGEST_LEN + 1];
+    int r;
+
+    newetag[0] = '\0';
+
+    if (sb != NULL) {
+        /*
+         * The update check is a conditional request of the digest of
+         * the database, a few bytes long: it tells if the database
+         * changed and which one the delta must rebuild.
+         */
+        r = fetch_digest(filepath, data, etag, sb->st_mtim.tv_sec, target);
+        if (r == FETCH_NOTMODIFIED || r < 0) {
+            return (r);
+        }
+        if (r == FETCH_OK) {
+            strlcpy(newetag, data->etag, sizeof(newetag));
+            r = fetch_delta(filepath, data, target);
+            if (r == FETCH_NOTMODIFIED) {
+                /* same database, the next check can use the new tag */
+                strlcpy(etag, newetag, etagsize);
+                return (r);
+            }
+            if (r < 0) {
+                printf("Delta update failed, fetching the whole database\n");
+            }
+        } else {
+            /* no digest published, check the database itself */
+            r = fetch_full(filepath, data, etag, sb->st_mtim.tv_sec);
+            if (r != FETCH_OK) {
+                return (r);
+            }
+        }
+    } else {
+        r = FETCH_NOTFOUND;
+    }
 
-    curl = curl_easy_init();
-    if (!curl) {
-        fprintf(stderr, "curl_easy_init failed\n");
-        goto error;
+    if (r != FETCH_OK) {
+        /* no usable delta, download the whole database */
+        r = fetch_full(filepath, data, NULL, 0);
+        if (r != FETCH_OK) {
+            return (r);
+        }
+    }
+    if (newetag[0] == '\0') {
+        strlcpy(newetag, data->etag, sizeof(newetag));
     }
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, provides_write_callback);
-    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, provides_progress_callback);
-    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    strlcpy(etag, newetag, etagsize);
+    return (FETCH_OK);
+}
 
-    write_data.fd = fo;
-    write_data.size = 0;
-    write_data.total_size = 0;
+/* Format of the database at path, "v4" or "v3", NULL if there is none */
+static const char *
+database_version(const char *path)
+{
+    struct db4 db4;
+    int fd, r;
 
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &write_data);
-    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &write_data);
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return (NULL);
+    }
+    if ((r = db4_open(&db4, fd)) == 0) {
+        db4_close(&db4);
+    }
+    close(fd);
 
-    provides_progressbar_start("Fetching provides database");
+    return (r == 1 ? "v3" : "v4");
+}
 
-    res = curl_easy_perform(curl);
+int
+plugin_fetch_file(void)
+{
+    int fo = -1;
+    struct curl_write_data write_data;
+    struct stat sb;
+    char path[] = PKG_DB_PATH;
+    char filepath[MAX_FN_SIZE + 1];
+    char tmpdb[] = PKG_DB_PATH "provides.db.XXXXXX";
+    char etag[sizeof(write_data.etag)];
+    const char *version;
+    bool conditional;
+    size_t i;
+    int dirfd, r;
 
-    provides_progressbar_stop();
-    curl_easy_cleanup(curl);
+    memset(&write_data, 0, sizeof(write_data));
 
-    if (res != CURLE_OK) {
-        fprintf(stderr, "curl download failed: %s\n", curl_easy_strerror(res));
-        goto error;
+    bool file_exists = (stat(PKG_DB_PATH "provides.db", &sb) == 0);
+
+    if (!file_exists) {
+        // Database doesn't exist, ensure directory exists
+        if (mkpath(path) != 0) {
+            fprintf(stderr, "Insufficient privileges to update the provides database.\n");
+            return (-1);
+        }
     }
 
-    printf("Extracting database....");
-    fflush(stdout);
+    /*
+     * The new database is written next to the live one and renamed
+     * over it once complete: searches running meanwhile keep reading
+     * the old file.
+     */
+    fo = mkstemp(tmpdb);
+    if (fo < 0) {
+        fprintf(stderr, "mkstemp failed: %s\n", strerror(errno));
+        return (-1);
+    }
+    fchmod(fo, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    write_data.fd = fo;
 
-    lseek(fo, 0, SEEK_SET);
-    if (plugin_archive_extract(fo, PKG_DB_PATH "provides.db") != 0) {
-        printf("fail\n");
+    etag[0] = '\0';
+    if (file_exists) {
+        read_etag(etag, sizeof(etag));
+    }
+    version = database_version(PKG_DB_PATH "provides.db");
+
+    /* the newest format the server publishes */
+    r = FETCH_NOTFOUND;
+    for (i = 0; i < sizeof(dbversions) / sizeof(dbversions[0]) &&
+        r == FETCH_NOTFOUND; i++) {
+        if (get_filepath(filepath, MAX_FN_SIZE, dbversions[i]) != 0) {
+            fprintf(stderr, "Can't get the OS ABI\n");
+            goto error;
+        }
+        /*
+         * A forced update doesn't trust the local database, neither
+         * do the databases of another format.
+         */
+        conditional = file_exists && !force_flag &&
+            (config_get_filepath() != NULL ||
+            (version != NULL && strcmp(version, dbversions[i]) == 0));
+        r = fetch_database(filepath, &write_data,
+            conditional ? &sb : NULL, etag, sizeof(etag));
+        if (config_get_filepath() != NULL) {
+            break;
+        }
+    }
+    if (r == FETCH_NOTMODIFIED) {
+        printf("The provides database is up-to-date.\n");
+        write_etag(etag);
+        close(fo);
+        unlink(tmpdb);
+        return (0);
+    }
+    if (r != FETCH_OK) {
+        if (r > 0) {
+            fprintf(stderr, "Provides database not found: %s/%s\n", config_get_remote_srv(), filepath);
+        }
         goto error;
     }
-    lchmod(PKG_DB_PATH "provides.db", S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    printf("success\n");
 
+    if (fsync(fo) != 0) {
+        fprintf(stderr, "Could not write the database: %s\n", strerror(errno));
+        goto error;
+    }
     close(fo);
+    fo = -1;
+
+    /*
+     * The index records the identity of the new file and rename(2)
+     * keeps it, a search between the two renames sees an index that
+     * doesn't match its database and scans the whole database.
+     * A v4 database is searched without one.
+     */
+    version = database_version(tmpdb);
+    if (version != NULL && strcmp(version, "v4") == 0) {
+        unlink(PKG_DB_PATH "provides.idx");
+    } else {
+        printf("Indexing database....");
+        fflush(stdout);
+        if (index_build(tmpdb, PKG_DB_PATH "provides.idx") != 0) {
+            /* searches still work, they just scan the whole database */
+            printf("fail\n");
+            unlink(PKG_DB_PATH "provides.idx");
+        } else {
+            printf("success\n");
+        }
+    }
+
+    if (rename(tmpdb, PKG_DB_PATH "provides.db") != 0) {
+        fprintf(stderr, "Could not install the database: %s\n", strerror(errno));
+        unlink(tmpdb);
+        return (-1);
+    }
+    if ((dirfd = open(PKG_DB_PATH, O_RDONLY | O_DIRECTORY)) >= 0) {
+        fsync(dirfd);
+        close(dirfd);
+    }
+    write_etag(etag);
+    /* the cached results belong to the previous database */
+    cache_clear(PKG_DB_PATH "cache");
 
     return EPKG_OK;
 
 error:
-    provides_progressbar_stop();
-
-    if (fo >= 0) {
-        close(fo);
-    }
+    close(fo);
+    unlink(tmpdb);
 
     return (-1);
 }
 
+/*
+ * Below this number of packages one exact query per package is cheaper
+ * than walking the whole repository catalogue.
+ */
+#define CATALOGUE_SCAN_MIN 64
+
+/*
+ * Look up the packages of the search result in the catalogue of
+ * repo_name, setting pnode->pkg for the ones it provides.
+ */
 static void
-free_list(struct pkg_head_t *head) {
-    fpkg_t *pnode, *prev_n;
-    file_t *pfile, *prev_f;
-
-    prev_n = NULL;
-    SLIST_FOREACH(pnode,head, next) {
-        if (prev_n) {
-            free(prev_n);
-        }
-        prev_f = NULL;
-        SLIST_FOREACH(pfile,&(pnode->files), next) {
-            if (prev_f) {
-                free(prev_f);
+lookup_repo(struct pkgdb *db, char *repo_name, struct search_t *search)
+{
+    struct pkgdb_it *it;
+    struct pkg *pkg = NULL;
+    fpkg_t *pnode;
+    char name[MAXPATHLEN];
+
+    if (HASH_COUNT(search->pkgs) < CATALOGUE_SCAN_MIN) {
+        SLIST_FOREACH(pnode, &search->head, next) {
+            stats.queries++;
+            it = pkgdb_repo_query(db, pnode->pkg_name, MATCH_EXACT, repo_name);
+            if (it == NULL) {
+                continue;
+            }
+            if (pkgdb_it_next(it, &pnode->pkg, PKG_LOAD_BASIC) != EPKG_OK) {
+                pkg_free(pnode->pkg);
+                pnode->pkg = NULL;
             }
-            free(pfile->name);
-            prev_f = pfile;
+            pkgdb_it_free(it);
         }
-        free(pnode->pkg_name);
-        prev_n = pnode;
+        return;
     }
 
+    /* single pass over the catalogue, joined on the package name */
+    stats.queries++;
+    it = pkgdb_repo_query(db, NULL, MATCH_ALL, repo_name);
+    if (it == NULL) {
+        return;
+    }
+    while (pkgdb_it_next(it, &pkg, PKG_LOAD_BASIC) == EPKG_OK) {
+        pkg_snprintf(name, sizeof(name), "%n", pkg);
+        HASH_FIND_STR(search->pkgs, name, pnode);
+        if (pnode != NULL && pnode->pkg == NULL) {
+            pnode->pkg = pkg;
+            pkg = NULL;
+        }
+    }
+    pkg_free(pkg);
+    pkgdb_it_free(it);
 }
 
 static int
-display_per_repo(char *repo_name, struct pkg_head_t *head)
+display_per_repo(struct pkgdb *db, char *repo_name, struct search_t *search)
 {
-    struct pkgdb_it *it;
-    struct pkg *pkg = NULL;
-    struct pkg_repo *r = NULL;
-    struct pkgdb *db = NULL;
     fpkg_t *pnode;
     file_t *pfile;
 
-    int ret ;
+    lookup_repo(db, repo_name, search);
 
-    if (pkgdb_open_all(&db, PKGDB_REMOTE,repo_name) != EPKG_OK) {
-        fprintf(stderr, "Can't open %s database\n",repo_name);
-        return -1;
-    }
-
-    SLIST_FOREACH(pnode,head, next) {
-        it = pkgdb_repo_query(db,pnode->pkg_name,MATCH_EXACT,repo_name);
-        if (it == NULL) {
-            continue;
-        }
-
-        if ((ret = pkgdb_it_next(it, &pkg, PKG_LOAD_BASIC)) != EPKG_OK) {
-            pkgdb_it_free(it);
+    SLIST_FOREACH(pnode, &search->head, next) {
+        if (pnode->pkg == NULL) {
             continue;
         }
 
         printf("%-8s: ", "Name");
-        pkg_printf("%n-", pkg);
-        pkg_printf("%v\n", pkg);
+        pkg_printf("%n-", pnode->pkg);
+        pkg_printf("%v\n", pnode->pkg);
         printf("%-8s: ", "Comment");
-        pkg_printf("%c\n", pkg);
+        pkg_printf("%c\n", pnode->pkg);
         printf("%-8s: ", "Repo");
         printf("%s\n", repo_name);
 
@@ -472,127 +990,145 @@ display_per_repo(char *repo_name, struct pkg_head_t *head)
         if(SLIST_NEXT(pnode, next) != NULL) {
             printf("\n");
         }
-        pkgdb_it_free(it);
+        pkg_free(pnode->pkg);
+        pnode->pkg = NULL;
     }
-    pkgdb_close(db);
 
     return (0);
 }
 
-void
-match_cb(const char * line, struct search_t *search)
+/*
+ * Run the search in this process, on the database and its index unless
+ * its results are in the cache, which source tells. Returns -1 if the
+ * search can't be done.
+ */
+static int
+search_local(char *pattern, int mode, struct search_t *search,
+    const char **source)
 {
-    file_t *pfile;
-    fpkg_t *pnode;
-
-    char *separator = strstr(line,"*");
-    if(separator != NULL) {
-        char *exp;
-        char * fullpath = separator + 1;
+    struct provides_index idx;
+    struct provides_index *pidx = NULL;
+    const char *version;
+    uint64_t t;
+    int fd, ret;
+
+    t = stats_now();
+    fd = open(PKG_DB_PATH "provides.db", O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Provides database not found, please update first.\n");
+        return (-1);
+    }
+    if (config_cache() &&
+        cache_get(PKG_DB_PATH "cache", fd, mode, pattern, search) == 0) {
+        close(fd);
+        stats.ns[STATS_OPEN] = stats_now() - t;
+        *source = "cache";
+        return (0);
+    }
+    if (index_open(&idx, PKG_DB_PATH "provides.idx", fd) == 0) {
+        pidx = &idx;
+    }
+    stats.ns[STATS_OPEN] = stats_now() - t;
+    if (pidx != NULL) {
+        *source = "index";
+    } else if ((version = database_version(PKG_DB_PATH "provides.db")) != NULL &&
+        strcmp(version, "v4") == 0) {
+        *source = "v4";
+    } else {
+        *source = "scan";
+    }
 
-        if(strstr(search->pattern,"/")) {
-            exp = fullpath;
-        } else {
-            exp = basename(fullpath);
-        }
+    t = stats_now();
 
-        if (pcre2_match(search->regex, (PCRE2_SPTR)exp, strlen(exp), 0, 0, search->match_data, NULL) > 0) {
-            int found = 0;
-            char * name = strndup(line, (separator - line + 1));
-            name[separator - line] = '\0';
-            SLIST_FOREACH(pnode,&(search->head), next) {
-                if(strcmp(pnode->pkg_name, name)==0) {
-                    found = 1;
-                    break;
-                }
-            }
+    if (mode == SEARCH_LIST) {
+        ret = search_package(search, fd, pidx, pattern);
+    } else if (mode == SEARCH_EXACT) {
+        ret = search_exact(search, fd, pidx, pattern);
+    } else if (search_init(search, pattern) == 0) {
+        ret = search_run(search, fd, pidx);
+    } else {
+        ret = -2;
+    }
+    stats.ns[STATS_SCAN] = stats_now() - t;
+    if (ret == -1) {
+        fprintf(stderr, "Provides database corrupted, perform a forced update to correct it.\n");
+    } else if (ret == 0 && config_cache()) {
+        cache_put(PKG_DB_PATH "cache", fd, mode, pattern, search);
+    }
 
-            if (found == 0) {
-                pnode = malloc (sizeof(struct fpkg_t));
-                if (pnode == NULL) {
-                    exit(ENOMEM);
-                } else {
-                    pnode->pkg_name = name;
-                    if(pnode->pkg_name == NULL) {
-                        exit(ENOMEM);
-                    }
-                    SLIST_INIT (&(pnode->files));
-                }
-                SLIST_INSERT_HEAD(&(search->head),pnode,next);
-            } else {
-                free(name);
-            }
-            pfile = malloc(sizeof(struct file_t));
-            if(pfile == NULL) {
-                exit(ENOMEM);
-            }
-            pfile->name = strdup(fullpath + 1);
-            if(pfile->name == NULL) {
-                exit(ENOMEM);
-            }
-            SLIST_INSERT_HEAD(&pnode->files,pfile,next);
-        }
+    if (pidx != NULL) {
+        index_close(pidx);
     }
+    close(fd);
+    return (ret == -2 ? -1 : 0);
 }
 
 int
-plugin_provides_search(char *repo, char *pattern)
+plugin_provides_search(char *repo, char *pattern, int mode)
 {
-    FILE *fh;
-    PCRE2_SIZE pcreErrorOffset;
-    int pcreErrorNumber;
     char *repo_name;
     struct pkg_repo *r = NULL;
+    struct pkgdb *db = NULL;
+    const char *source = "server";
+    uint64_t start, t;
 
     struct search_t search;
 
-    memset(&search, 0, sizeof(search));
-
-    search.pattern = pattern;
-
-    SLIST_INIT (&search.head);
-
-    fh = fopen(PKG_DB_PATH "provides.db","r");
-    if (fh == NULL) {
-        fprintf(stderr, "Provides database not found, please update first.\n");
-        return (-1);
+    start = stats_now();
+    /* the query server answers when it is running */
+    if (server_query(config_socket_path(), mode, pattern, &search) != 0) {
+        if (search_local(pattern, mode, &search, &source) != 0) {
+            return (-1);
+        }
+    } else {
+        stats.ns[STATS_SCAN] = stats_now() - start;
     }
 
-    search.regex = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED, PCRE2_CASELESS, &pcreErrorNumber, &pcreErrorOffset, NULL);
-
-    if(search.regex == NULL) {
-        fprintf(stderr, "Invalid search pattern\n");
-        goto error_pcre;
+    t = stats_now();
+    if (SLIST_EMPTY(&search.head)) {
+        goto done;
     }
 
-    search.match_data = pcre2_match_data_create_from_pattern(search.regex, NULL);
-
-    if (bigram_expand(fh, &match_cb, &search) == -1) {
-        fprintf(stderr, "Corrupted database\n");
+    if (pkgdb_open_all(&db, PKGDB_REMOTE, repo) != EPKG_OK) {
+        fprintf(stderr, "Can't open %s database\n", repo ? repo : "remote");
+        goto done;
     }
 
     while (pkg_repos(&r) == EPKG_OK) {
         if (pkg_repo_enabled(r)) {
             repo_name = (char *)pkg_repo_name(r);
             if (repo == NULL || strcmp(repo, repo_name) == 0) {
-                display_per_repo(repo_name, &search.head);
+                display_per_repo(db, repo_name, &search);
             }
         }
     }
+    pkgdb_close(db);
 
-    pcre2_match_data_free(search.match_data);
-
-    fclose(fh);
-    pcre2_code_free(search.regex);
-    free_list(&search.head);
+done:
+    search_free(&search);
+    if (stats_enabled) {
+        stats.ns[STATS_JOIN] = stats_now() - t;
+        stats.ns[STATS_TOTAL] = stats_now() - start;
+        stats_print(stderr, source);
+    }
     return (0);
+}
+
+static int
+plugin_provides_batch(char *file)
+{
+    int fd, ret;
 
-error_pcre:
-    fclose(fh);
-    if (search.regex != NULL) {
-        pcre2_code_free(search.regex);
+    fd = open(PKG_DB_PATH "provides.db", O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Provides database not found, please update first.\n");
+        return (-1);
     }
-    return (-1);
+
+    ret = batch_run(fd, file);
+    close(fd);
+
+    return (ret);
 }
 
 int cb_event(void *data, struct pkgdb *db) {
@@ -608,9 +1144,17 @@ plugin_provides_callback(int argc, char **argv)
 {
     int ch;
     bool do_update = false;
+    bool do_serve = false;
     char *repo = NULL;
-
-    while ((ch = getopt(argc, argv, "ufr:")) != -1) {
+    char *batch = NULL;
+    int mode = SEARCH_PATTERN;
+    static struct option longopts[] = {
+        { "stats", optional_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    stats_enabled = config_stats();
+    while ((ch = getopt_long(argc, argv, "ufr:b:eld", longopts, NULL)) != -1) {
         switch (ch) {
         case 'u':
             do_update = true;
@@ -621,6 +1165,28 @@ plugin_provides_callback(int argc, char **argv)
         case 'r':
             repo = optarg;
             break;
+        case 'b':
+            batch = optarg;
+            break;
+        case 'e':
+            mode = SEARCH_EXACT;
+            break;
+        case 'l':
+            mode = SEARCH_LIST;
+            break;
+        case 'd':
+            do_serve = true;
+            break;
+        case 's':
+            if (optarg == NULL) {
+                stats_enabled = STATS_TEXT;
+            } else if (strcmp(optarg, "json") == 0) {
+                stats_enabled = STATS_JSON;
+            } else {
+                plugin_provides_usage();
+                return (EX_USAGE);
+            }
+            break;
         default:
             plugin_provides_usage();
             return (EX_USAGE);
@@ -632,15 +1198,25 @@ plugin_provides_callback(int argc, char **argv)
         return plugin_fetch_file();
     }
 
+    if (do_serve) {
+        return (server_run(PKG_DB_PATH "provides.db",
+            PKG_DB_PATH "provides.idx", config_socket_path()) == 0 ?
+            EPKG_OK : EPKG_FATAL);
+    }
+
     argc -= optind;
     argv += optind;
 
+    if (batch != NULL) {
+        return (plugin_provides_batch(batch) == 0 ? EPKG_OK : EPKG_FATAL);
+    }
+
     if (argc <= 0) {
         plugin_provides_usage();
         return (EX_USAGE);
     }
 
-    plugin_provides_search(repo, argv[0]);
+    plugin_provides_search(repo, argv[0], mode);
 
     return (EPKG_OK);
 }
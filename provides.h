@@ -0,0 +1,312 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROVIDES_H_
+#define _PROVIDES_H_
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <uthash.h>
+
+#ifndef PCRE2_CODE_UNIT_WIDTH
+#define PCRE2_CODE_UNIT_WIDTH 8
+#endif
+#include <pcre2.h>
+
+/* ASCII case folding, the one PCRE2 applies with its default tables */
+#define LOWER(c)    (((c) >= 'A' && (c) <= 'Z') ? (c) - 'A' + 'a' : (c))
+
+/* Fixed little-endian encoding of the on-disk indexes */
+static inline void
+put_le32(u_char *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static inline void
+put_le64(u_char *p, uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline uint32_t
+get_le32(const u_char *p)
+{
+    return ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+        (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+static inline uint64_t
+get_le64(const u_char *p)
+{
+    return ((uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32);
+}
+
+/* arena.c */
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *chunks;
+    char *cur;
+    size_t left;
+};
+
+void *arena_alloc(struct arena *a, size_t size);
+char *arena_strndup(struct arena *a, const char *s, size_t len);
+void arena_free(struct arena *a);
+
+/* stats.c */
+#define STATS_OPEN      0           /* database, index and cache */
+#define STATS_SCAN      1           /* decoding, matching and grouping */
+#define STATS_DECODE    2           /* cumulated over the threads */
+#define STATS_REGEX     3           /* cumulated over the threads */
+#define STATS_GROUP     4
+#define STATS_JOIN      5           /* catalogue queries and output */
+#define STATS_TOTAL     6
+#define STATS_NPHASES   7
+
+#define STATS_TEXT      1           /* values of stats_enabled */
+#define STATS_JSON      2
+
+struct stats {
+    uint64_t ns[STATS_NPHASES];
+    uint64_t bytes;                 /* database bytes decoded */
+    uint64_t entries;               /* entries decoded */
+    uint64_t regex;
+    uint64_t matches;
+    uint64_t packages;
+    uint64_t queries;               /* catalogue queries */
+};
+
+extern int stats_enabled;
+extern struct stats stats;
+
+uint64_t stats_now(void);
+void stats_merge(const struct stats *s);
+void stats_print(FILE *fp, const char *source);
+
+/* pattern.c */
+#define PATTERN_MAX_LITERALS 16
+
+struct pattern {
+    int nliterals;
+    char *literals[PATTERN_MAX_LITERALS];   /* lower case, longest first */
+    size_t lens[PATTERN_MAX_LITERALS];
+    const char *prefix;                     /* literal after a leading ^ */
+    size_t prefix_len;
+    const char *suffix;                     /* literal before a final $ */
+    size_t suffix_len;
+};
+
+int pattern_analyse(struct pattern *pat, const char *regex);
+int pattern_prefilter(const struct pattern *pat, const char *s, size_t len);
+void pattern_free(struct pattern *pat);
+
+/* index.c */
+struct provides_index {
+    u_char *map;
+    size_t size;
+    uint64_t nentries;
+    uint32_t nblocks;
+    uint32_t ntrigrams;
+    uint32_t npackages;
+    uint32_t nanchors;
+    uint32_t hash_bits;
+    uint32_t nnames;                /* distinct basenames */
+    uint32_t nnamegroups;
+    const u_char *blocks;
+    const u_char *trigrams;
+    const u_char *postings;
+    const u_char *packages;
+    const u_char *anchors;
+    const u_char *paths;
+    const u_char *basenames;
+    const u_char *names;
+    const u_char *strings;
+    size_t postings_size;
+    size_t paths_size;
+    size_t basenames_size;
+    size_t names_size;
+    size_t strings_size;
+};
+
+struct bigram_iter;
+
+int index_build(const char *dbpath, const char *idxpath);
+int index_open(struct provides_index *idx, const char *path, int dbfd);
+int index_candidates(struct provides_index *idx, const struct pattern *pat,
+    u_char *cand);
+int index_block(struct provides_index *idx, uint32_t i, struct bigram_iter *it);
+uint32_t index_package(struct provides_index *idx, const char *name,
+    uint32_t *first);
+int index_package_run(struct provides_index *idx, uint32_t i,
+    struct bigram_iter *it);
+int index_anchor(struct provides_index *idx, uint32_t i, struct bigram_iter *it);
+int index_lookup(struct provides_index *idx, const char *key, bool basename,
+    uint32_t **anchors);
+int index_names(struct provides_index *idx, uint32_t i,
+    bool (*match)(const char *, size_t, void *), void *arg, u_char *hits);
+int index_name_anchors(struct provides_index *idx, const u_char *hits,
+    u_char *anchors);
+void index_close(struct provides_index *idx);
+
+/* db4.c */
+struct db4 {
+    u_char *map;
+    size_t size;
+    uint32_t ndirs;
+    uint32_t nbasenames;
+    uint32_t npackages;
+    uint64_t nfiles;
+    const u_char *dirs;             /* offsets of the blocks */
+    const u_char *dirdata;
+    const u_char *basenames;        /* offsets of the blocks */
+    const u_char *bndata;
+    const u_char *records;
+    const u_char *packages;
+    const char *pkgnames;
+    size_t dirdata_size;
+    size_t bndata_size;
+    size_t records_size;
+    size_t pkgnames_size;
+    uint32_t *dirtab;               /* parent and name of each directory */
+    uint32_t *bntab;                /* offset of each basename in bnbuf */
+    char *bnbuf;
+};
+
+struct search_t;
+
+int db4_open(struct db4 *db, int fd);
+int db4_search(struct db4 *db, struct search_t *search);
+int db4_package(struct db4 *db, struct search_t *search, const char *name);
+int db4_exact(struct db4 *db, struct search_t *search, const char *key);
+int db4_expand(struct db4 *db, void (*match_cb)(const char *, void *),
+    void *extra);
+void db4_close(struct db4 *db);
+
+/* search.c */
+struct pkg;
+
+typedef struct file_t {
+    char *name;
+    SLIST_ENTRY (file_t) next;
+} file_t;
+SLIST_HEAD (file_head_t, file_t);
+
+typedef struct fpkg_t {
+    char *pkg_name;
+    struct file_head_t files;
+    SLIST_ENTRY (fpkg_t) next;
+    UT_hash_handle hh;
+    struct pkg *pkg;                /* catalogue entry, while displayed */
+} fpkg_t;
+SLIST_HEAD (pkg_head_t, fpkg_t);
+
+/* per thread matching state */
+struct matcher {
+    pcre2_match_data *match_data;
+    pcre2_match_context *match_context;
+    pcre2_jit_stack *jit_stack;
+    struct stats stats;             /* counters of this thread */
+};
+
+struct search_t {
+    struct pkg_head_t head;
+    fpkg_t *pkgs;                   /* packages of head, by name */
+    struct arena arena;             /* storage of head */
+    pcre2_code *regex;
+    fpkg_t *pnode;                  /* package of the last match */
+    char * pattern;
+    bool basename;                  /* no '/' in pattern, match basenames */
+    bool jit;
+    struct matcher matcher;
+    struct pattern literals;
+};
+
+#define SEARCH_PATTERN  0
+#define SEARCH_EXACT    1           /* pattern is a path or a basename */
+#define SEARCH_LIST     2           /* pattern is a package name */
+
+int search_init(struct search_t *search, char *pattern);
+int matcher_init(struct matcher *m, struct search_t *search);
+void matcher_free(struct matcher *m);
+bool match_path(struct search_t *search, struct matcher *m, const char *exp,
+    size_t len);
+void search_add_file(struct search_t *search, const char *name, size_t len,
+    const char *fullpath);
+int search_run(struct search_t *search, int fd, struct provides_index *idx);
+int search_package(struct search_t *search, int fd, struct provides_index *idx,
+    const char *name);
+int search_exact(struct search_t *search, int fd, struct provides_index *idx,
+    const char *key);
+void search_free(struct search_t *search);
+const char *search_match(struct search_t *search, const char *line);
+int search_add(struct search_t *search, const char *line);
+int search_write(struct search_t *search, FILE *fp);
+void match_cb(const char *line, void *extra);
+
+/* batch.c */
+int batch_run(int fd, const char *file);
+
+/* cache.c */
+int cache_get(const char *dir, int dbfd, int mode, const char *pattern,
+    struct search_t *search);
+void cache_put(const char *dir, int dbfd, int mode, const char *pattern,
+    struct search_t *search);
+void cache_clear(const char *dir);
+
+/* server.c */
+int server_run(const char *dbpath, const char *idxpath, const char *sockpath);
+int server_query(const char *sockpath, int mode, const char *pattern,
+    struct search_t *search);
+
+/* progressbar.c */
+void provides_progressbar_start(const char *pmsg);
+void provides_progressbar_stop(void);
+void provides_progressbar_tick(int64_t current, int64_t total);
+
+/* mkpath.c */
+int mkpath(char *path);
+
+/* configure.c */
+#define REGEX_ENGINE_AUTO   0       /* JIT when available */
+#define REGEX_ENGINE_JIT    1
+#define REGEX_ENGINE_INTERP 2
+
+int config_fetch_on_update();
+int config_cache();
+int config_stats();
+int config_regex_engine();
+int config_jobs();
+char *config_get_remote_srv();
+char *config_get_filepath();
+char *config_socket_path();
+
+#endif /* _PROVIDES_H_ */
@@ -0,0 +1,857 @@
+/*-
+ * Copyright (c) 2017 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Search engine: match the database entries against the pattern and
+ * group the matching files per package.
+ *
+ * When provides.idx is available the candidate blocks are decoded
+ * and matched by a pool of threads, each block being a restart point
+ * of the front-coded database. The matching lines of each block are
+ * buffered and grouped in database order once all threads are done.
+ * A pattern without '/' is matched against the distinct basenames of
+ * the index first, only the entries following the anchors of the
+ * matching ones are decoded.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bigram.h"
+#include "provides.h"
+
+#define JIT_STACK_START (32 * 1024)
+#define JIT_STACK_MAX (512 * 1024)
+
+/* matching lines of a block, NUL separated */
+struct block_result {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+struct pool {
+    struct search_t *search;
+    struct provides_index *idx;
+    const u_char *db;
+    size_t dbsize;
+    int (*seek)(struct provides_index *, uint32_t, struct bigram_iter *);
+    uint32_t *blocks;               /* candidate blocks, in order */
+    uint32_t nblocks;
+    struct block_result *results;
+    u_char *hits;                   /* matching names */
+    atomic_uint next;               /* next block to process */
+    atomic_int error;
+};
+
+struct name_match {
+    struct search_t *search;
+    struct matcher *m;
+};
+
+int
+matcher_init(struct matcher *m, struct search_t *search)
+{
+    memset(m, 0, sizeof(*m));
+
+    m->match_data = pcre2_match_data_create_from_pattern(search->regex, NULL);
+    m->match_context = pcre2_match_context_create(NULL);
+    if (m->match_data == NULL || m->match_context == NULL) {
+        return (-1);
+    }
+
+    if (search->jit) {
+        m->jit_stack = pcre2_jit_stack_create(JIT_STACK_START, JIT_STACK_MAX, NULL);
+        if (m->jit_stack == NULL) {
+            return (-1);
+        }
+        pcre2_jit_stack_assign(m->match_context, NULL, m->jit_stack);
+    }
+
+    return (0);
+}
+
+void
+matcher_free(struct matcher *m)
+{
+    pcre2_match_data_free(m->match_data);
+    pcre2_match_context_free(m->match_context);
+    if (m->jit_stack != NULL) {
+        pcre2_jit_stack_free(m->jit_stack);
+    }
+    memset(m, 0, sizeof(*m));
+}
+
+int
+search_init(struct search_t *search, char *pattern)
+{
+    PCRE2_SIZE pcreErrorOffset;
+    int pcreErrorNumber;
+    int engine;
+
+    memset(search, 0, sizeof(*search));
+
+    search->pattern = pattern;
+    search->basename = (strchr(pattern, '/') == NULL);
+    SLIST_INIT (&search->head);
+
+    search->regex = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED, PCRE2_CASELESS, &pcreErrorNumber, &pcreErrorOffset, NULL);
+    if (search->regex == NULL) {
+        fprintf(stderr, "Invalid search pattern\n");
+        return (-1);
+    }
+
+    engine = config_regex_engine();
+    if (engine != REGEX_ENGINE_INTERP) {
+        search->jit = (pcre2_jit_compile(search->regex, PCRE2_JIT_COMPLETE) == 0);
+        if (!search->jit && engine == REGEX_ENGINE_JIT) {
+            fprintf(stderr, "PCRE2 JIT is not available\n");
+            pcre2_code_free(search->regex);
+            return (-1);
+        }
+    }
+
+    if (matcher_init(&search->matcher, search) != 0 ||
+        pattern_analyse(&search->literals, pattern) != 0) {
+        exit(ENOMEM);
+    }
+
+    return (0);
+}
+
+void
+search_free(struct search_t *search)
+{
+    stats_merge(&search->matcher.stats);
+    matcher_free(&search->matcher);
+    pcre2_code_free(search->regex);
+    pattern_free(&search->literals);
+    HASH_CLEAR(hh, search->pkgs);
+    arena_free(&search->arena);
+    SLIST_INIT (&search->head);
+    search->pnode = NULL;
+}
+
+/*
+ * Match exp, a path or a basename of len bytes, against the pattern
+ * with the matching state m.
+ */
+bool
+match_path(struct search_t *search, struct matcher *m, const char *exp,
+    size_t len)
+{
+    uint64_t t = 0;
+    int rc;
+
+    /* without literal there is nothing to check */
+    if (search->literals.nliterals > 0 &&
+        !pattern_prefilter(&search->literals, exp, len)) {
+        return (false);
+    }
+
+    m->stats.regex++;
+    if (stats_enabled) {
+        t = stats_now();
+    }
+    if (search->jit) {
+        rc = pcre2_jit_match(search->regex, (PCRE2_SPTR)exp, len, 0, 0, m->match_data, m->match_context);
+    } else {
+        rc = pcre2_match(search->regex, (PCRE2_SPTR)exp, len, 0, 0, m->match_data, m->match_context);
+    }
+    if (stats_enabled) {
+        m->stats.ns[STATS_REGEX] += stats_now() - t;
+    }
+
+    return (rc > 0);
+}
+
+/*
+ * Match a "pkgname*path" line against the pattern. It runs on the pool
+ * threads, hence the basename taken in place rather than with
+ * basename(3), which may return a static buffer.
+ * Returns a pointer to the separator if it matches, NULL otherwise.
+ */
+static const char *
+match_line(struct search_t *search, struct matcher *m, const char *line)
+{
+    const char *separator, *exp, *slash;
+
+    m->stats.entries++;
+    separator = strchr(line, '*');
+    if (separator == NULL) {
+        return (NULL);
+    }
+    exp = separator + 1;
+
+    if (search->basename && (slash = strrchr(exp, '/')) != NULL) {
+        exp = slash + 1;
+    }
+
+    return (match_path(search, m, exp, strlen(exp)) ? separator : NULL);
+}
+
+/*
+ * Add the file fullpath of the package name, len bytes long, to the
+ * results. The database is sorted by package so the entry is usually
+ * the one of the previous match, otherwise it is looked up in the hash
+ * table.
+ */
+void
+search_add_file(struct search_t *search, const char *name, size_t len,
+    const char *fullpath)
+{
+    file_t *pfile;
+    fpkg_t *pnode;
+    uint64_t t = 0;
+
+    if (stats_enabled) {
+        t = stats_now();
+    }
+    pnode = search->pnode;
+    if (pnode == NULL || strncmp(pnode->pkg_name, name, len) != 0 ||
+        pnode->pkg_name[len] != '\0') {
+        HASH_FIND(hh, search->pkgs, name, len, pnode);
+        if (pnode == NULL) {
+            pnode = arena_alloc(&search->arena, sizeof(struct fpkg_t));
+            pnode->pkg_name = arena_strndup(&search->arena, name, len);
+            SLIST_INIT (&(pnode->files));
+            pnode->pkg = NULL;
+            HASH_ADD_KEYPTR(hh, search->pkgs, pnode->pkg_name, len, pnode);
+            SLIST_INSERT_HEAD(&(search->head),pnode,next);
+            search->matcher.stats.packages++;
+        }
+        search->pnode = pnode;
+    }
+
+    pfile = arena_alloc(&search->arena, sizeof(struct file_t));
+    pfile->name = arena_strndup(&search->arena, fullpath + 1, strlen(fullpath + 1));
+    SLIST_INSERT_HEAD(&pnode->files,pfile,next);
+    search->matcher.stats.matches++;
+    if (stats_enabled) {
+        search->matcher.stats.ns[STATS_GROUP] += stats_now() - t;
+    }
+}
+
+/* Add the file of a matching "pkgname*path" line to the results */
+static void
+add_match(struct search_t *search, const char *line, const char *separator)
+{
+    search_add_file(search, line, separator - line, separator + 1);
+}
+
+/*
+ * Match a database line against the pattern of search, on the calling
+ * thread. Returns a pointer to the separator if it matches.
+ */
+const char *
+search_match(struct search_t *search, const char *line)
+{
+    return (match_line(search, &search->matcher, line));
+}
+
+void
+match_cb(const char * line, void *extra)
+{
+    struct search_t *search = extra;
+    const char *separator;
+
+    separator = match_line(search, &search->matcher, line);
+    if (separator != NULL) {
+        add_match(search, line, separator);
+    }
+}
+
+/*
+ * Add a "pkgname*path" database line to the results of search, as
+ * received from the query server. Returns -1 if it is malformed.
+ */
+int
+search_add(struct search_t *search, const char *line)
+{
+    const char *separator;
+
+    if ((separator = strchr(line, '*')) == NULL || separator[1] == '\0') {
+        return (-1);
+    }
+    add_match(search, line, separator);
+
+    return (0);
+}
+
+/*
+ * Write the results of search on fp as "pkgname*path" lines, in the
+ * order search_add() rebuilds the same lists from. Returns -1 on a
+ * write error.
+ */
+int
+search_write(struct search_t *search, FILE *fp)
+{
+    fpkg_t **pkgs, *pnode;
+    file_t **files = NULL, *pfile;
+    size_t npkgs = 0, nfiles, cap = 0, i, j;
+
+    SLIST_FOREACH(pnode, &search->head, next) {
+        npkgs++;
+    }
+    if ((pkgs = malloc((npkgs + 1) * sizeof(fpkg_t *))) == NULL) {
+        exit(ENOMEM);
+    }
+    i = npkgs;
+    SLIST_FOREACH(pnode, &search->head, next) {
+        pkgs[--i] = pnode;
+    }
+
+    /* the lists are built by inserting at their head */
+    for (i = 0; i < npkgs; i++) {
+        nfiles = 0;
+        SLIST_FOREACH(pfile, &pkgs[i]->files, next) {
+            if (nfiles == cap) {
+                cap = cap ? cap * 2 : 256;
+                if ((files = realloc(files, cap * sizeof(file_t *))) == NULL) {
+                    exit(ENOMEM);
+                }
+            }
+            files[nfiles++] = pfile;
+        }
+        for (j = nfiles; j > 0; j--) {
+            fprintf(fp, "%s*/%s\n", pkgs[i]->pkg_name, files[j - 1]->name);
+        }
+    }
+    free(files);
+    free(pkgs);
+
+    return (ferror(fp) ? -1 : 0);
+}
+
+static void
+result_add(struct block_result *res, const u_char *line, size_t len)
+{
+    char *buf;
+    size_t cap;
+
+    if (res->cap - res->len <= len) {
+        cap = res->cap ? res->cap * 2 : 4096;
+        while (cap - res->len <= len) {
+            cap *= 2;
+        }
+        if ((buf = realloc(res->buf, cap)) == NULL) {
+            exit(ENOMEM);
+        }
+        res->buf = buf;
+        res->cap = cap;
+    }
+    memcpy(res->buf + res->len, line, len + 1);
+    res->len += len + 1;
+}
+
+static void *
+pool_worker(void *arg)
+{
+    struct pool *pool = arg;
+    struct search_t *search = pool->search;
+    struct bigram_iter it;
+    struct matcher m;
+    unsigned int k;
+    uint64_t start = 0;
+    int r;
+
+    if (stats_enabled) {
+        start = stats_now();
+    }
+    if (matcher_init(&m, search) != 0) {
+        exit(ENOMEM);
+    }
+    if (bigram_iter_init(&it, pool->db, pool->dbsize) != 0) {
+        pool->error = 1;
+        goto done;
+    }
+
+    while (!pool->error && (k = atomic_fetch_add(&pool->next, 1)) < pool->nblocks) {
+        if (pool->seek(pool->idx, pool->blocks[k], &it) != 0) {
+            pool->error = 1;
+            break;
+        }
+        m.stats.bytes += it.end - it.p;
+        while ((r = bigram_iter_next(&it)) > 0) {
+            if (match_line(search, &m, (char *)it.path) != NULL) {
+                result_add(&pool->results[k], it.path, it.len);
+            }
+        }
+        if (r < 0) {
+            pool->error = 1;
+        }
+    }
+
+done:
+    if (stats_enabled) {
+        m.stats.ns[STATS_DECODE] = stats_now() - start -
+            m.stats.ns[STATS_REGEX];
+    }
+    stats_merge(&m.stats);
+    matcher_free(&m);
+    return (NULL);
+}
+
+/* Run worker on njobs threads, or on the calling one */
+static void
+pool_run(struct pool *pool, void *(*worker)(void *), int njobs)
+{
+    pthread_t *threads = NULL;
+    int started = 0;
+
+    if (njobs > 1) {
+        if ((threads = calloc(njobs, sizeof(pthread_t))) == NULL) {
+            exit(ENOMEM);
+        }
+        for (; started < njobs; started++) {
+            if (pthread_create(&threads[started], NULL, worker, pool) != 0) {
+                break;
+            }
+        }
+    }
+    if (started == 0) {
+        /* no thread at all, do the work ourselves */
+        worker(pool);
+    }
+    while (started > 0) {
+        pthread_join(threads[--started], NULL);
+    }
+    free(threads);
+}
+
+/*
+ * Decode and match the candidates among the n blocks, or anchors,
+ * positioned by seek, on config_jobs() threads when there is more than
+ * one to process.
+ */
+static int
+search_blocks(struct search_t *search, struct provides_index *idx,
+    const u_char *db, size_t dbsize, const u_char *cand, uint32_t n,
+    int (*seek)(struct provides_index *, uint32_t, struct bigram_iter *))
+{
+    struct pool pool;
+    struct bigram_iter it;
+    const char *line, *separator;
+    uint32_t i;
+    int njobs, r, ret = 0;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.blocks = malloc((n + 1) * sizeof(uint32_t));
+    if (pool.blocks == NULL) {
+        exit(ENOMEM);
+    }
+    for (i = 0; i < n; i++) {
+        if (cand[i]) {
+            pool.blocks[pool.nblocks++] = i;
+        }
+    }
+
+    njobs = config_jobs();
+    if (njobs > (int)pool.nblocks) {
+        njobs = pool.nblocks;
+    }
+
+    if (njobs <= 1) {
+        /* not worth a thread, match in place */
+        if (bigram_iter_init(&it, db, dbsize) != 0) {
+            ret = -1;
+        }
+        for (i = 0; ret == 0 && i < pool.nblocks; i++) {
+            if (seek(idx, pool.blocks[i], &it) != 0) {
+                ret = -1;
+                break;
+            }
+            search->matcher.stats.bytes += it.end - it.p;
+            while ((r = bigram_iter_next(&it)) > 0) {
+                match_cb((char *)it.path, search);
+            }
+            if (r < 0) {
+                ret = -1;
+            }
+        }
+        free(pool.blocks);
+        return (ret);
+    }
+
+    pool.search = search;
+    pool.idx = idx;
+    pool.seek = seek;
+    pool.db = db;
+    pool.dbsize = dbsize;
+    atomic_init(&pool.next, 0);
+    atomic_init(&pool.error, 0);
+    pool.results = calloc(pool.nblocks, sizeof(struct block_result));
+    if (pool.results == NULL) {
+        exit(ENOMEM);
+    }
+    pool_run(&pool, pool_worker, njobs);
+
+    if (pool.error) {
+        ret = -1;
+    }
+
+    /* merge in database order */
+    for (i = 0; i < pool.nblocks; i++) {
+        for (line = pool.results[i].buf;
+            line < pool.results[i].buf + pool.results[i].len;
+            line += strlen(line) + 1) {
+            if ((separator = strchr(line, '*')) != NULL) {
+                add_match(search, line, separator);
+            }
+        }
+        free(pool.results[i].buf);
+    }
+
+    free(pool.results);
+    free(pool.blocks);
+
+    return (ret);
+}
+
+static bool
+name_cb(const char *name, size_t len, void *arg)
+{
+    struct name_match *nm = arg;
+
+    return (match_path(nm->search, nm->m, name, len));
+}
+
+static void *
+names_worker(void *arg)
+{
+    struct pool *pool = arg;
+    struct name_match nm;
+    struct matcher m;
+    unsigned int k;
+
+    if (matcher_init(&m, pool->search) != 0) {
+        exit(ENOMEM);
+    }
+    nm.search = pool->search;
+    nm.m = &m;
+
+    while (!pool->error && (k = atomic_fetch_add(&pool->next, 1)) < pool->nblocks) {
+        if (index_names(pool->idx, k, name_cb, &nm, pool->hits) != 0) {
+            pool->error = 1;
+        }
+    }
+
+    stats_merge(&m.stats);
+    matcher_free(&m);
+    return (NULL);
+}
+
+/*
+ * Match the pattern of search against the distinct basenames of the
+ * index, then decode and match the entries of the anchors of those
+ * matching it.
+ */
+static int
+search_names(struct search_t *search, struct provides_index *idx,
+    const u_char *db, size_t dbsize)
+{
+    struct pool pool;
+    u_char *anchors;
+    int njobs, ret;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.search = search;
+    pool.idx = idx;
+    pool.nblocks = idx->nnamegroups;
+    atomic_init(&pool.next, 0);
+    atomic_init(&pool.error, 0);
+    pool.hits = calloc(idx->nnames + 1, 1);
+    anchors = calloc(idx->nanchors + 1, 1);
+    if (pool.hits == NULL || anchors == NULL) {
+        exit(ENOMEM);
+    }
+
+    njobs = config_jobs();
+    if (njobs > (int)pool.nblocks) {
+        njobs = pool.nblocks;
+    }
+    search->matcher.stats.bytes += idx->names_size;
+    pool_run(&pool, names_worker, njobs);
+
+    if (pool.error || index_name_anchors(idx, pool.hits, anchors) != 0) {
+        ret = -1;
+    } else {
+        ret = search_blocks(search, idx, db, dbsize, anchors, idx->nanchors,
+            index_anchor);
+    }
+
+    free(anchors);
+    free(pool.hits);
+    return (ret);
+}
+
+/*
+ * Search the database open on fd, using its index idx unless it is
+ * NULL. A v4 database needs no index. Returns -1 if the database is
+ * corrupted.
+ */
+int
+search_run(struct search_t *search, int fd, struct provides_index *idx)
+{
+    struct db4 db4;
+    struct stat sb;
+    u_char *cand, *db;
+    uint32_t i, n;
+    int ret = 1;
+
+    if ((ret = db4_open(&db4, fd)) <= 0) {
+        if (ret == 0) {
+            ret = db4_search(&db4, search);
+            db4_close(&db4);
+        }
+        return (ret);
+    }
+
+    if (idx != NULL && fstat(fd, &sb) == 0) {
+        db = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (db != MAP_FAILED) {
+            if ((cand = malloc(idx->nblocks + 1)) != NULL) {
+                memset(cand, 1, idx->nblocks);
+                if (index_candidates(idx, &search->literals, cand) >= 0) {
+                    for (i = 0, n = 0; i < idx->nblocks; i++) {
+                        n += cand[i];
+                    }
+                    if (search->basename && (uint64_t)idx->nnames *
+                        idx->nblocks < (uint64_t)n * idx->nentries) {
+                        /* fewer names to match than entries to decode */
+                        ret = search_names(search, idx, db, sb.st_size);
+                    } else {
+                        ret = search_blocks(search, idx, db, sb.st_size,
+                            cand, idx->nblocks, index_block);
+                    }
+                }
+                free(cand);
+            }
+            munmap(db, sb.st_size);
+        }
+    }
+
+    if (ret == 1) {
+        /* no usable index, scan the whole database */
+        if (fstat(fd, &sb) == 0) {
+            search->matcher.stats.bytes += sb.st_size;
+        }
+        ret = bigram_expand_fd(fd, &match_cb, search);
+    }
+
+    return (ret);
+}
+
+struct package_scan {
+    struct search_t *search;
+    const char *name;
+    size_t len;
+};
+
+static void
+package_cb(const char *line, void *extra)
+{
+    struct package_scan *scan = extra;
+
+    scan->search->matcher.stats.entries++;
+    if (strncmp(line, scan->name, scan->len) == 0 &&
+        line[scan->len] == '*') {
+        add_match(scan->search, line, line + scan->len);
+    }
+}
+
+/*
+ * Collect the files of package name from the database open on fd.
+ * The package table of its index idx gives the location of its entries,
+ * the whole database is scanned when idx is NULL.
+ * Returns -1 if the database is corrupted.
+ */
+int
+search_package(struct search_t *search, int fd, struct provides_index *idx,
+    const char *name)
+{
+    struct bigram_iter it;
+    struct package_scan scan;
+    struct db4 db4;
+    struct stat sb;
+    u_char *db;
+    uint32_t first, n, i;
+    int r, ret = 1;
+
+    memset(search, 0, sizeof(*search));
+    SLIST_INIT (&search->head);
+
+    if ((ret = db4_open(&db4, fd)) <= 0) {
+        if (ret == 0) {
+            ret = db4_package(&db4, search, name);
+            db4_close(&db4);
+        }
+        return (ret);
+    }
+
+    scan.search = search;
+    scan.name = name;
+    scan.len = strlen(name);
+
+    if (idx != NULL) {
+        if (fstat(fd, &sb) == 0) {
+            db = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (db != MAP_FAILED) {
+                ret = bigram_iter_init(&it, db, sb.st_size);
+                n = index_package(idx, name, &first);
+                for (i = 0; ret == 0 && i < n; i++) {
+                    if (index_package_run(idx, first + i, &it) != 0) {
+                        ret = -1;
+                        break;
+                    }
+                    while ((r = bigram_iter_next(&it)) > 0) {
+                        package_cb((char *)it.path, &scan);
+                    }
+                    if (r < 0) {
+                        ret = -1;
+                    }
+                }
+                munmap(db, sb.st_size);
+            }
+        }
+    }
+
+    if (ret == 1) {
+        /* no usable index, scan the whole database */
+        if (fstat(fd, &sb) == 0) {
+            search->matcher.stats.bytes += sb.st_size;
+        }
+        ret = bigram_expand_fd(fd, &package_cb, &scan);
+    }
+
+    return (ret);
+}
+
+struct exact_scan {
+    struct search_t *search;
+    const char *key;
+    size_t len;
+    bool basename;
+};
+
+static void
+exact_cb(const char *line, void *extra)
+{
+    struct exact_scan *scan = extra;
+    const char *path, *p;
+
+    scan->search->matcher.stats.entries++;
+    if ((path = strchr(line, '*')) == NULL) {
+        return;
+    }
+    path++;
+    if (scan->basename && (p = strrchr(path, '/')) != NULL) {
+        p++;
+    } else {
+        p = path;
+    }
+    if (strlen(p) == scan->len && memcmp(p, scan->key, scan->len) == 0) {
+        add_match(scan->search, line, path - 1);
+    }
+}
+
+/*
+ * Collect the entries of the database open on fd whose path is key, or
+ * whose basename is key when it has no '/'. The hash tables of its index
+ * idx give the anchors to decode, the whole database is scanned when idx
+ * is NULL. Returns -1 if the database is corrupted.
+ */
+int
+search_exact(struct search_t *search, int fd, struct provides_index *idx,
+    const char *key)
+{
+    struct bigram_iter it;
+    struct exact_scan scan;
+    struct db4 db4;
+    struct stat sb;
+    u_char *db;
+    uint32_t *anchors;
+    int r, i, n, ret = 1;
+
+    memset(search, 0, sizeof(*search));
+    SLIST_INIT (&search->head);
+
+    if ((ret = db4_open(&db4, fd)) <= 0) {
+        if (ret == 0) {
+            ret = db4_exact(&db4, search, key);
+            db4_close(&db4);
+        }
+        return (ret);
+    }
+
+    scan.search = search;
+    scan.key = key;
+    scan.len = strlen(key);
+    scan.basename = strchr(key, '/') == NULL;
+
+    if (idx != NULL) {
+        if (fstat(fd, &sb) == 0 &&
+            (n = index_lookup(idx, key, scan.basename, &anchors)) >= 0) {
+            db = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (db != MAP_FAILED) {
+                ret = bigram_iter_init(&it, db, sb.st_size);
+                for (i = 0; ret == 0 && i < n; i++) {
+                    if (index_anchor(idx, anchors[i], &it) != 0) {
+                        ret = -1;
+                        break;
+                    }
+                    while ((r = bigram_iter_next(&it)) > 0) {
+                        exact_cb((char *)it.path, &scan);
+                    }
+                    if (r < 0) {
+                        ret = -1;
+                    }
+                }
+                munmap(db, sb.st_size);
+            }
+            free(anchors);
+        }
+    }
+
+    if (ret == 1) {
+        /* no usable index, scan the whole database */
+        if (fstat(fd, &sb) == 0) {
+            search->matcher.stats.bytes += sb.st_size;
+        }
+        ret = bigram_expand_fd(fd, &exact_cb, &scan);
+    }
+
+    return (ret);
+}
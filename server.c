@@ -0,0 +1,440 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Query server: pkg provides -d keeps the database and its index open
+ * and answers the searches of the other pkg provides processes over a
+ * UNIX socket.
+ *
+ * A request is a single line made of the search mode, 'p' for a
+ * pattern, 'e' for an exact lookup or 'l' for a package listing,
+ * followed by the pattern. The reply is "OK" then the matching database
+ * lines, "pkgname*path", one per line, the server closing the connection
+ * after the last one. Anything else, "ERR" included, tells the client to
+ * run the search itself.
+ *
+ * Each client is served on its own thread, up to SERVER_CLIENTS at a
+ * time, so a slow client or a long search doesn't hold the others.
+ *
+ * The database is reopened when provides.db has been replaced by an
+ * update, before answering the next request. The requests running
+ * meanwhile keep the database they started with, it is closed by the
+ * last of them.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "provides.h"
+
+#define SERVER_BACKLOG  64
+#define SERVER_CLIENTS  32          /* clients served at the same time */
+#define SERVER_TIMEOUT  10          /* seconds to send a request */
+
+static const char modes[] = { 'p', 'e', 'l' };
+
+struct server_db {
+    int fd;
+    struct stat sb;
+    struct provides_index idx;
+    bool has_idx;
+    int refs;                       /* requests, plus one while current */
+};
+
+struct server {
+    const char *dbpath;
+    const char *idxpath;
+    struct server_db *db;           /* current database, NULL if none */
+    int clients;                    /* client threads running */
+    pthread_mutex_t lock;
+    pthread_cond_t done;            /* signaled when a client is done */
+};
+
+struct server_client {
+    struct server *srv;
+    int s;
+};
+
+static volatile sig_atomic_t server_stop;
+
+static void
+server_signal(int sig __unused)
+{
+    server_stop = 1;
+}
+
+/* Drop a reference to sdb, with the server lock held */
+static void
+server_unref(struct server_db *sdb)
+{
+    if (--sdb->refs > 0)
+        return;
+    if (sdb->has_idx)
+        index_close(&sdb->idx);
+    close(sdb->fd);
+    free(sdb);
+}
+
+static void
+server_release(struct server *srv, struct server_db *sdb)
+{
+    pthread_mutex_lock(&srv->lock);
+    server_unref(sdb);
+    pthread_mutex_unlock(&srv->lock);
+}
+
+/*
+ * Return the database at srv->dbpath, opening it unless the one already
+ * open is still there, with a reference the caller drops with
+ * server_release(). Returns NULL if there is no database.
+ */
+static struct server_db *
+server_acquire(struct server *srv)
+{
+    struct server_db *sdb;
+    struct stat sb;
+
+    pthread_mutex_lock(&srv->lock);
+    sdb = srv->db;
+    if (stat(srv->dbpath, &sb) != 0) {
+        sdb = NULL;
+    } else if (sdb == NULL || sb.st_dev != sdb->sb.st_dev ||
+        sb.st_ino != sdb->sb.st_ino || sb.st_size != sdb->sb.st_size ||
+        sb.st_mtim.tv_sec != sdb->sb.st_mtim.tv_sec ||
+        sb.st_mtim.tv_nsec != sdb->sb.st_mtim.tv_nsec) {
+        if ((sdb = calloc(1, sizeof(*sdb))) != NULL &&
+            (sdb->fd = open(srv->dbpath, O_RDONLY)) >= 0 &&
+            fstat(sdb->fd, &sdb->sb) == 0) {
+            sdb->has_idx = (index_open(&sdb->idx, srv->idxpath,
+                sdb->fd) == 0);
+            sdb->refs = 1;
+        } else if (sdb != NULL) {
+            if (sdb->fd >= 0)
+                close(sdb->fd);
+            free(sdb);
+            sdb = NULL;
+        }
+    }
+    if (sdb != srv->db) {
+        if (srv->db != NULL)
+            server_unref(srv->db);
+        srv->db = sdb;
+    }
+    if (sdb != NULL)
+        sdb->refs++;
+    pthread_mutex_unlock(&srv->lock);
+
+    return (sdb);
+}
+
+/* Run the request and write the reply on out */
+static void
+server_answer(struct server_db *sdb, char *request, FILE *out)
+{
+    struct search_t search;
+    struct provides_index *idx;
+    int mode, ret;
+
+    for (mode = 0; mode < (int)sizeof(modes); mode++) {
+        if (request[0] == modes[mode])
+            break;
+    }
+    if (mode == (int)sizeof(modes) || request[1] != ' ' ||
+        request[2] == '\0') {
+        fprintf(out, "ERR\n");
+        return;
+    }
+    request += 2;
+
+    idx = sdb->has_idx ? &sdb->idx : NULL;
+    if (mode == SEARCH_LIST) {
+        ret = search_package(&search, sdb->fd, idx, request);
+    } else if (mode == SEARCH_EXACT) {
+        ret = search_exact(&search, sdb->fd, idx, request);
+    } else {
+        if (search_init(&search, request) != 0) {
+            fprintf(out, "ERR\n");
+            return;
+        }
+        ret = search_run(&search, sdb->fd, idx);
+    }
+
+    if (ret == 0) {
+        fprintf(out, "OK\n");
+        search_write(&search, out);
+    } else {
+        fprintf(out, "ERR\n");
+    }
+    search_free(&search);
+}
+
+static void
+server_client(struct server *srv, int s)
+{
+    struct timeval tv = { SERVER_TIMEOUT, 0 };
+    struct server_db *sdb;
+    char request[MAXPATHLEN + 4];
+    FILE *in, *out;
+    int d;
+    size_t len;
+
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if ((in = fdopen(s, "r")) == NULL) {
+        close(s);
+        return;
+    }
+    if ((d = dup(s)) < 0 || (out = fdopen(d, "w")) == NULL) {
+        if (d >= 0)
+            close(d);
+        fclose(in);
+        return;
+    }
+
+    if (fgets(request, sizeof(request), in) != NULL) {
+        len = strlen(request);
+        if (len > 0 && request[len - 1] == '\n') {
+            request[len - 1] = '\0';
+            if ((sdb = server_acquire(srv)) != NULL) {
+                server_answer(sdb, request, out);
+                server_release(srv, sdb);
+            } else {
+                fprintf(out, "ERR\n");
+            }
+        }
+    }
+    fclose(out);
+    fclose(in);
+}
+
+static void *
+server_thread(void *arg)
+{
+    struct server_client *sc = arg;
+    struct server *srv = sc->srv;
+
+    server_client(srv, sc->s);
+    free(sc);
+
+    pthread_mutex_lock(&srv->lock);
+    srv->clients--;
+    pthread_cond_signal(&srv->done);
+    pthread_mutex_unlock(&srv->lock);
+
+    return (NULL);
+}
+
+/* Serve the client connected on s on a new thread */
+static void
+server_spawn(struct server *srv, int s)
+{
+    struct server_client *sc;
+    pthread_attr_t attr;
+    pthread_t thread;
+    sigset_t set, oset;
+    int r;
+
+    pthread_mutex_lock(&srv->lock);
+    while (srv->clients >= SERVER_CLIENTS)
+        pthread_cond_wait(&srv->done, &srv->lock);
+    srv->clients++;
+    pthread_mutex_unlock(&srv->lock);
+
+    if ((sc = malloc(sizeof(*sc))) == NULL) {
+        r = -1;
+    } else {
+        sc->srv = srv;
+        sc->s = s;
+        /* the signals stopping the server are left to the main thread */
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &set, &oset);
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        r = pthread_create(&thread, &attr, server_thread, sc);
+        pthread_attr_destroy(&attr);
+        pthread_sigmask(SIG_SETMASK, &oset, NULL);
+    }
+    if (r != 0) {
+        /* serve it on this thread */
+        free(sc);
+        server_client(srv, s);
+        pthread_mutex_lock(&srv->lock);
+        srv->clients--;
+        pthread_mutex_unlock(&srv->lock);
+    }
+}
+
+/*
+ * Serve the database at dbpath on the UNIX socket sockpath until
+ * SIGINT or SIGTERM. Returns -1 if the socket can't be set up.
+ */
+int
+server_run(const char *dbpath, const char *idxpath, const char *sockpath)
+{
+    struct server srv;
+    struct server_db *sdb;
+    struct sockaddr_un sun;
+    struct sigaction sa;
+    int s, c;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlcpy(sun.sun_path, sockpath, sizeof(sun.sun_path)) >=
+        sizeof(sun.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", sockpath);
+        return (-1);
+    }
+
+    if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return (-1);
+    }
+    /* a socket left by a server that didn't exit cleanly */
+    unlink(sockpath);
+    if (bind(s, (struct sockaddr *)&sun, sizeof(sun)) != 0 ||
+        chmod(sockpath, 0666) != 0 || listen(s, SERVER_BACKLOG) != 0) {
+        fprintf(stderr, "%s: %s\n", sockpath, strerror(errno));
+        close(s);
+        return (-1);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&srv, 0, sizeof(srv));
+    srv.dbpath = dbpath;
+    srv.idxpath = idxpath;
+    pthread_mutex_init(&srv.lock, NULL);
+    pthread_cond_init(&srv.done, NULL);
+    if ((sdb = server_acquire(&srv)) != NULL) {
+        server_release(&srv, sdb);
+    } else {
+        fprintf(stderr, "Provides database not found, please update first.\n");
+    }
+
+    while (!server_stop) {
+        if ((c = accept(s, NULL, NULL)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(stderr, "accept: %s\n", strerror(errno));
+            break;
+        }
+        server_spawn(&srv, c);
+    }
+
+    close(s);
+    unlink(sockpath);
+    /* let the clients being served get their reply */
+    pthread_mutex_lock(&srv.lock);
+    while (srv.clients > 0)
+        pthread_cond_wait(&srv.done, &srv.lock);
+    if (srv.db != NULL)
+        server_unref(srv.db);
+    pthread_mutex_unlock(&srv.lock);
+    pthread_mutex_destroy(&srv.lock);
+    pthread_cond_destroy(&srv.done);
+
+    return (0);
+}
+
+/*
+ * Ask the server listening on sockpath to run the search. Returns -1
+ * if there is no server or it can't answer, the results it sent are
+ * dropped then.
+ */
+int
+server_query(const char *sockpath, int mode, const char *pattern,
+    struct search_t *search)
+{
+    struct sockaddr_un sun;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    FILE *fp;
+    int s, ret = -1;
+
+    memset(search, 0, sizeof(*search));
+    SLIST_INIT (&search->head);
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlcpy(sun.sun_path, sockpath, sizeof(sun.sun_path)) >=
+        sizeof(sun.sun_path) || strchr(pattern, '\n') != NULL)
+        return (-1);
+
+    if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return (-1);
+    if (connect(s, (struct sockaddr *)&sun, sizeof(sun)) != 0 ||
+        (fp = fdopen(s, "r+")) == NULL) {
+        close(s);
+        return (-1);
+    }
+
+    if (fprintf(fp, "%c %s\n", modes[mode], pattern) > 0 &&
+        fflush(fp) == 0 && (len = getline(&line, &cap, fp)) > 0 &&
+        strcmp(line, "OK\n") == 0) {
+        ret = 0;
+        while ((len = getline(&line, &cap, fp)) > 0) {
+            if (line[len - 1] != '\n') {
+                /* the server went away */
+                ret = -1;
+                break;
+            }
+            line[len - 1] = '\0';
+            if (search_add(search, line) != 0) {
+                ret = -1;
+                break;
+            }
+        }
+        if (ferror(fp))
+            ret = -1;
+    }
+    free(line);
+    fclose(fp);
+
+    if (ret != 0)
+        search_free(search);
+
+    return (ret);
+}
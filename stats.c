@@ -0,0 +1,124 @@
+/*-
+ * Copyright (c) 2026 Rodrigo Osorio <rodrigo@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Timings and counters of a search, printed on stderr with --stats or
+ * PROVIDES_STATS. Time is measured with CLOCK_MONOTONIC. The decoding
+ * and regex times of the matching threads are cumulated, they may add
+ * up to more than the wall time of the scan.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "provides.h"
+
+int stats_enabled;
+struct stats stats;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *phases[STATS_NPHASES] = {
+    "open", "scan", "decode", "regex", "group", "join", "total",
+};
+
+uint64_t
+stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* Add the counters of a thread or of a search to the totals */
+void
+stats_merge(const struct stats *s)
+{
+    int i;
+
+    pthread_mutex_lock(&stats_lock);
+    for (i = 0; i < STATS_NPHASES; i++)
+        stats.ns[i] += s->ns[i];
+    stats.bytes += s->bytes;
+    stats.entries += s->entries;
+    stats.regex += s->regex;
+    stats.matches += s->matches;
+    stats.packages += s->packages;
+    stats.queries += s->queries;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Print the totals on fp, source telling where the results come from:
+ * "index", "scan" (no usable index), "v4" (a v4 database, which needs
+ * none), "cache" or "server".
+ */
+void
+stats_print(FILE *fp, const char *source)
+{
+    const uint64_t *ns = stats.ns;
+    int i;
+
+    /*
+     * A search without threads doesn't time its decoding, which is then
+     * left out rather than guessed from the other phases.
+     */
+    if (stats_enabled == STATS_JSON) {
+        fprintf(fp, "{\"source\":\"%s\"", source);
+        for (i = 0; i < STATS_NPHASES; i++) {
+            if (i == STATS_DECODE && ns[i] == 0)
+                continue;
+            fprintf(fp, ",\"%s_us\":%ju", phases[i],
+                (uintmax_t)ns[i] / 1000);
+        }
+        fprintf(fp, ",\"bytes\":%ju,\"entries\":%ju,\"regex\":%ju,"
+            "\"matches\":%ju,\"packages\":%ju,\"queries\":%ju}\n",
+            (uintmax_t)stats.bytes, (uintmax_t)stats.entries,
+            (uintmax_t)stats.regex, (uintmax_t)stats.matches,
+            (uintmax_t)stats.packages, (uintmax_t)stats.queries);
+        return;
+    }
+
+    fprintf(fp, "Statistics (%s search):\n", source);
+    for (i = 0; i < STATS_NPHASES; i++) {
+        if (i == STATS_DECODE && ns[i] == 0)
+            fprintf(fp, "  %-8s %15s\n", phases[i], "not measured");
+        else
+            fprintf(fp, "  %-8s %12.3f ms\n", phases[i], ns[i] / 1e6);
+    }
+    fprintf(fp, "  %-18s %12ju\n", "bytes read", (uintmax_t)stats.bytes);
+    fprintf(fp, "  %-18s %12ju\n", "entries decoded",
+        (uintmax_t)stats.entries);
+    fprintf(fp, "  %-18s %12ju\n", "regex invocations",
+        (uintmax_t)stats.regex);
+    fprintf(fp, "  %-18s %12ju\n", "matches", (uintmax_t)stats.matches);
+    fprintf(fp, "  %-18s %12ju\n", "packages", (uintmax_t)stats.packages);
+    fprintf(fp, "  %-18s %12ju\n", "catalogue queries",
+        (uintmax_t)stats.queries);
+}